@@ -2,37 +2,6 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION //only place once in one .cpp files
 #include "image_lib.h"
 
-Color Color::operator+(const Color& rhs) const {
-    return Color(r + rhs.r, g + rhs.g, b + rhs.b);
-}
-Color Color::operator*(const Color& rhs) const {
-    return Color(r * rhs.r, g * rhs.g, b * rhs.b);
-}
-Color Color::operator*(const float& rhs) const {
-    return Color(r * rhs, g * rhs, b * rhs);
-}
-
-bool Color::operator==(const Color& rhs) const {
-    return r == rhs.r && g == rhs.g && b == rhs.b;
-}
-
-bool Color::operator<(const Color& rhs) const {
-    return r < rhs.r && g < rhs.g && b < rhs.b;
-}
-
-Color Color::Lerp(const Color& rhs, float amt) const {
-    float nr = LERP(r, rhs.r, amt);
-    float ng = LERP(g, rhs.g, amt);
-    float nb = LERP(b, rhs.b, amt);
-    return Color(nr, ng, nb);
-}
-
-void Color::Clamp() {
-    r = fmin(r, 1);
-    g = fmin(g, 1);
-    b = fmin(b, 1);
-}
-
 Image::Image(int w, int h) : width(w), height(h) {
     pixels = new Color[width * height];
 }
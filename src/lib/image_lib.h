@@ -22,14 +22,22 @@ struct Color {
     Color(float r, float g, float b) : r(r), g(g), b(b) {}
     Color() : r(0), g(0), b(0) {}
 
-    Color Lerp(const Color& rhs, float amt) const;
-    void Clamp();
-
-    Color operator+(const Color& rhs) const;
-    Color operator*(const Color& rhs) const;
-    Color operator*(const float& rhs) const;
-    bool operator==(const Color& rhs) const;
-	bool operator<(const Color& rhs) const;
+    // Defined here rather than in image_lib.cpp so shading code can inline them.
+    Color Lerp(const Color& rhs, float amt) const {
+        return Color(LERP(r, rhs.r, amt), LERP(g, rhs.g, amt), LERP(b, rhs.b, amt));
+    }
+
+    void Clamp() {
+        r = r < 1 ? r : 1;
+        g = g < 1 ? g : 1;
+        b = b < 1 ? b : 1;
+    }
+
+    Color operator+(const Color& rhs) const { return Color(r + rhs.r, g + rhs.g, b + rhs.b); }
+    Color operator*(const Color& rhs) const { return Color(r * rhs.r, g * rhs.g, b * rhs.b); }
+    Color operator*(const float& rhs) const { return Color(r * rhs, g * rhs, b * rhs); }
+    bool operator==(const Color& rhs) const { return r == rhs.r && g == rhs.g && b == rhs.b; }
+	bool operator<(const Color& rhs) const { return r < rhs.r && g < rhs.g && b < rhs.b; }
 };
 
 struct Image {
@@ -4,15 +4,15 @@
 #include <math.h>
 #include <ostream>
 #include <string>
-#include <stdexcept>
 #include <iomanip>
 
 using std::string;
 using std::to_string;
-using std::runtime_error;
+
+// Everything here is header-only so the compiler can inline it into the intersection and shading loops.
 
 inline float fclamp(float a, float min, float max) {
-    return fmax(min, fmin(a, max));
+    return a < min ? min : (a > max ? max : a);
 }
 
 struct vec3i {
@@ -24,99 +24,110 @@ struct vec3i {
 
 
 inline vec3i imin(vec3i a, vec3i b) {
-	return vec3i(fmin(a.x, b.x), fmin(a.y, b.y), fmin(a.z, b.z));
+	return vec3i(a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y, a.z < b.z ? a.z : b.z);
 }
 
 inline vec3i imax(vec3i a, vec3i b) {
-	return vec3i(fmax(a.x, b.x), fmax(a.y, b.y), fmax(a.z, b.z));
+	return vec3i(a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y, a.z > b.z ? a.z : b.z);
 }
 
-#define BASE 16
-template<>
-struct std::hash<vec3i>{
-	size_t operator()(const vec3i& v) const {
-		return v.x * (BASE*BASE) + v.y * BASE + v.z;
-	}
-};
-
-struct vec3 {
-    double x, y, z;
+// Padded to four components, so a vec3 is one aligned 128-bit (float) or 256-bit (double) load.
+template <typename T>
+struct alignas(4 * sizeof(T)) vec3t {
+    typedef T scalar;
+    T x, y, z;
 
-    vec3(double x, double y, double z) : x(x), y(y), z(z) {}
-    vec3() : x(0), y(0), z(0) {}
+    vec3t(T x, T y, T z) : x(x), y(y), z(z) {}
+    vec3t() : x(0), y(0), z(0) {}
 
-    vec3 clamp(double min, double max) const { return vec3(fclamp(x, min, max), fclamp(y, min, max), fclamp(z, min, max)); }
+    vec3t clamp(T min, T max) const { return vec3t(fclamp(x, min, max), fclamp(y, min, max), fclamp(z, min, max)); }
 
-    double mag() const { return sqrt(x * x + y * y + z * z); }
-    double mag2() const { return x * x + y * y + z * z; }
+    T mag() const { return sqrt(x * x + y * y + z * z); }
+    T mag2() const { return x * x + y * y + z * z; }
 
     // Create a unit-length vector
-    vec3 normalized() const {
-        double len = mag();
-        return vec3(x / len, y / len, z / len);
+    vec3t normalized() const {
+        T inv_len = T(1) / mag();
+        return vec3t(x * inv_len, y * inv_len, z * inv_len);
     }
 
-    vec3& operator+=(vec3& a) {
+    vec3t& operator+=(const vec3t& a) {
         x += a.x;
         y += a.y;
 		z += a.z;
         return *this;
     }
 
-    vec3& operator-=(vec3& a) {
+    vec3t& operator-=(const vec3t& a) {
         x -= a.x;
         y -= a.y;
 		z -= a.z;
         return *this;
     }
 
-	vec3 operator-() const {
-		return vec3(-x, -y, -z);
+	vec3t operator-() const {
+		return vec3t(-x, -y, -z);
 	}
 
 
-	string keyed_string(string prefix) {
+	string keyed_string(string prefix) const {
 		return prefix + to_string(x) + " " + to_string(y) + " " + to_string(z);
 	}
 
-	double& operator[](int index) {
-		if (index == 0) return x;
-		if (index == 1) return y;
-		if (index == 2) return z;
-		throw runtime_error("vec3[] out of bounds");
-		return x;
+	// index must be 0, 1 or 2.
+	T& operator[](int index) {
+		return index == 0 ? x : (index == 1 ? y : z);
+	}
+
+	T operator[](int index) const {
+		return index == 0 ? x : (index == 1 ? y : z);
 	}
 };
 
-inline vec3 operator*(vec3 a, double f) {
-    return vec3(a.x * f, a.y * f, a.z * f);
+// Define VEC3_DOUBLE to build the renderer in double precision.
+#ifdef VEC3_DOUBLE
+typedef vec3t<double> vec3;
+#else
+typedef vec3t<float> vec3;
+#endif
+
+// The scalar is taken in the vector's precision, so vec3 * 0.5 works without a cast.
+template <typename T>
+inline vec3t<T> operator*(vec3t<T> a, typename vec3t<T>::scalar f) {
+    return vec3t<T>(a.x * f, a.y * f, a.z * f);
 }
 
-inline vec3 operator*(double f, vec3 a) {
-    return vec3(a.x * f, a.y * f, a.z * f);
+template <typename T>
+inline vec3t<T> operator*(typename vec3t<T>::scalar f, vec3t<T> a) {
+    return vec3t<T>(a.x * f, a.y * f, a.z * f);
 }
 
 // Vector-vector dot product
-inline double dot(vec3 a, vec3 b) {
+template <typename T>
+inline T dot(vec3t<T> a, vec3t<T> b) {
     return a.x * b.x + a.y * b.y + a.z * b.z;
 }
 
 // Vector-vector cross product
-inline vec3 cross(vec3 a, vec3 b) {
-    return vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+template <typename T>
+inline vec3t<T> cross(vec3t<T> a, vec3t<T> b) {
+    return vec3t<T>(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
 }
 
 // Vector addition
-inline vec3 operator+(vec3 a, vec3 b) {
-    return vec3(a.x + b.x, a.y + b.y, a.z + b.z);
+template <typename T>
+inline vec3t<T> operator+(vec3t<T> a, vec3t<T> b) {
+    return vec3t<T>(a.x + b.x, a.y + b.y, a.z + b.z);
 }
 
 // Vector subtraction
-inline vec3 operator-(vec3 a, vec3 b) {
-    return vec3(a.x - b.x, a.y - b.y, a.z - b.z);
+template <typename T>
+inline vec3t<T> operator-(vec3t<T> a, vec3t<T> b) {
+    return vec3t<T>(a.x - b.x, a.y - b.y, a.z - b.z);
 }
 
-inline std::ostream& operator<<(std::ostream& os, vec3 v3) {
+template <typename T>
+inline std::ostream& operator<<(std::ostream& os, vec3t<T> v3) {
     return os << std::fixed << std::setprecision(2) << "{" << v3.z << ", " << v3.y << "}";
 }
 
@@ -126,4 +137,4 @@ inline bool same_side(vec3 p1, vec3 p2, vec3 a, vec3 b) {
     return dot(cp1, cp2) >= 0;
 }
 
-#endif
\ No newline at end of file
+#endif
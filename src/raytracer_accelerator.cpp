@@ -0,0 +1,45 @@
+#include "raytracer_accelerator.h"
+
+namespace Raytracer {
+
+const char* accelerator_names[ACCEL_COUNT] = {"None", "BVH", "Grid", "Wide BVH"};
+
+int Accelerator::FindIntersection(const RayPacket& packet, HitInformation* hits) {
+    int hit_mask = 0;
+    for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+        if ((packet.active & (1 << lane)) && FindIntersection(packet.rays[lane], &hits[lane]))
+            hit_mask |= 1 << lane;
+    }
+    return hit_mask;
+}
+
+bool LinearScan::FindIntersection(const Ray& ray, HitInformation* intersection) {
+    PrimitiveHit current_hit, best_hit;
+    float dist = -1.0;
+    for (uint32_t prim = 0; prim < prims->Count(); prim++) {
+        if (prims->Intersect(prim, ray, &current_hit)) {
+            if (dist == -1.0 || current_hit.t < dist) {
+                best_hit = current_hit;
+                dist = current_hit.t;
+            }
+        }
+    }
+    if (dist == -1.0)
+        return false;
+    prims->Resolve(ray, best_hit, intersection);
+    return true;
+}
+
+bool LinearScan::Occluded(const Ray& ray, float t_max) {
+    for (uint32_t prim = 0; prim < prims->Count(); prim++) {
+        if (prims->Occluded(prim, ray, t_max))
+            return true;
+    }
+    return false;
+}
+
+string LinearScan::Stats() {
+    return "Linear scan over " + to_string(prims->Count()) + " primitives";
+}
+
+}  // namespace Raytracer
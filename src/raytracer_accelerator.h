@@ -0,0 +1,52 @@
+#ifndef _RAYTRACER_ACCELERATOR_H
+#define _RAYTRACER_ACCELERATOR_H
+
+#include <string>
+#include <vector>
+
+#include "raytracer_geometry.h"
+#include "raytracer_packet.h"
+#include "raytracer_primitives.h"
+#include "raytracer_ray.h"
+
+using namespace std;
+
+namespace Raytracer {
+
+enum AcceleratorType {
+    ACCEL_NONE,
+    ACCEL_BVH,
+    ACCEL_GRID,
+    ACCEL_WIDE_BVH,
+    ACCEL_COUNT
+};
+
+extern const char* accelerator_names[ACCEL_COUNT];
+
+// Non-enforced abstract class for ray traversal structures. Rebuilt from the scene in PreRender().
+struct Accelerator {
+    float build_ms = 0;
+    // What Build() was given. Accelerators store primitive indices into it, so it has to outlive them.
+    const PrimitiveArrays* prims = NULL;
+
+    virtual void Build(const PrimitiveArrays& primitives) { prims = &primitives; }
+    virtual bool FindIntersection(const Ray& ray, HitInformation* intersection) { return false; }
+    // Closest hits for every active lane, written to hits[lane]. Returns the lanes that hit something.
+    // Traces the lanes one at a time unless overridden.
+    virtual int FindIntersection(const RayPacket& packet, HitInformation* hits);
+    // Whether anything lies along the ray closer than t_max. Stops at the first blocker.
+    virtual bool Occluded(const Ray& ray, float t_max) { return false; }
+    // Summary for the debug log.
+    virtual string Stats() { return ""; }
+};
+
+// Tests every primitive, the way the renderer worked before it had acceleration structures.
+struct LinearScan : Accelerator {
+    bool FindIntersection(const Ray& ray, HitInformation* intersection);
+    bool Occluded(const Ray& ray, float t_max);
+    string Stats();
+};
+
+}  // namespace Raytracer
+
+#endif
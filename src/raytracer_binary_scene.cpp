@@ -0,0 +1,415 @@
+#include "raytracer_binary_scene.h"
+#include "raytracer_mapped_file.h"
+#include "raytracer_render.h"
+
+#include <algorithm>
+#include <string.h>
+#include <unordered_map>
+
+namespace Raytracer {
+
+static const char P3B_MAGIC[4] = {'P', '3', 'B', '\0'};
+static_assert(P3B_OUTPUT_NAME_LEN == CHARARRAY_LEN, "output_name is stored as is");
+
+static P3bVec3 ToP3b(const vec3& v) { return P3bVec3{(float)v.x, (float)v.y, (float)v.z}; }
+static P3bVec3 ToP3b(const Color& c) { return P3bVec3{c.r, c.g, c.b}; }
+static vec3 ToVec3(const P3bVec3& v) { return vec3(v.x, v.y, v.z); }
+static Color ToColor(const P3bVec3& c) { return Color(c.x, c.y, c.z); }
+
+// The records of a section, or NULL if it doesn't fit inside the file.
+template <class T>
+static const T* SectionData(const MappedFile& file, const P3bSection& section) {
+    if (section.offset % 8 != 0 || section.offset > file.size || section.count > (file.size - section.offset) / sizeof(T))
+        return NULL;
+    return (const T*)(file.data + section.offset);
+}
+
+static void CopyVectors(const P3bVec3* in, size_t count, vector<vec3>& out) {
+    out.resize(count);
+    if (sizeof(vec3) == sizeof(P3bVec3)) {
+        memcpy(out.data(), in, count * sizeof(P3bVec3));
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = ToVec3(in[i]);
+        }
+    }
+}
+
+bool LoadBinaryFile(const string& path) {
+    Reset();
+
+    steady_clock::time_point load_start = steady_clock::now();
+    MappedFile file;
+    if (!file.Open(path))
+        return false;
+    if (file.size < sizeof(P3bHeader) || memcmp(file.data, P3B_MAGIC, 4) != 0) {
+        Log(path + " is not a binary scene");
+        return false;
+    }
+    const P3bHeader* header = (const P3bHeader*)file.data;
+    if (header->version != P3B_VERSION) {
+        Log(path + " is binary scene version " + to_string(header->version) + ", expected " + to_string(P3B_VERSION));
+        return false;
+    }
+
+    const P3bMaterial* in_materials = SectionData<P3bMaterial>(file, header->materials);
+    const P3bShape* in_shapes = SectionData<P3bShape>(file, header->shapes);
+    const P3bLight* in_lights = SectionData<P3bLight>(file, header->lights);
+    const P3bVec3* in_vertices = SectionData<P3bVec3>(file, header->vertices);
+    const P3bVec3* in_normals = SectionData<P3bVec3>(file, header->normals);
+    const uint32_t* vertex_indices = SectionData<uint32_t>(file, header->vertex_indices);
+    const uint32_t* normal_indices = SectionData<uint32_t>(file, header->normal_indices);
+    const P3bSphere* in_spheres = SectionData<P3bSphere>(file, header->spheres);
+    if (!in_materials || !in_shapes || !in_lights || !in_vertices || !in_normals || !vertex_indices || !normal_indices ||
+        !in_spheres || header->materials.count == 0) {
+        Log(path + " is truncated");
+        return false;
+    }
+
+    // Every index is checked once here so a damaged file can't send the renderer outside the buffers.
+    uint64_t vertex_count = header->vertices.count, normal_count = header->normals.count;
+    for (uint64_t i = 0; i < header->vertex_indices.count; i++) {
+        if (vertex_indices[i] >= vertex_count) {
+            Log(path + " has a vertex index out of range");
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header->normal_indices.count; i++) {
+        if (normal_indices[i] >= normal_count) {
+            Log(path + " has a normal index out of range");
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < header->shapes.count; i++) {
+        const P3bShape& s = in_shapes[i];
+        bool valid = s.material < header->materials.count;
+        if (s.type == P3B_MESH) {
+            valid = valid && s.count % 3 == 0 && (uint64_t)s.first + s.count <= header->vertex_indices.count &&
+                    (!s.smooth || (uint64_t)s.normal_first + s.count <= header->normal_indices.count);
+        } else if (s.type == P3B_SPHERE_CLOUD) {
+            valid = valid && (uint64_t)s.first + s.count <= header->spheres.count;
+        } else if (s.type == P3B_TRIANGLE || s.type == P3B_NORMAL_TRIANGLE) {
+            valid = valid && (uint64_t)s.first + 3 <= vertex_count &&
+                    (s.type == P3B_TRIANGLE || (uint64_t)s.normal_first + 3 <= normal_count);
+        } else {
+            valid = valid && s.type == P3B_SPHERE;
+        }
+        if (!valid) {
+            Log(path + " has a broken shape record");
+            return false;
+        }
+    }
+
+    const P3bCamera& c = header->camera;
+    camera->id = c.id;
+    camera->position = ToVec3(c.position);
+    camera->forward = ToVec3(c.forward);
+    camera->up = ToVec3(c.up);
+    camera->background_color = ToColor(c.background);
+    camera->half_vfov = c.half_vfov;
+    camera->res = vec3i(c.res_x, c.res_y, 0);
+    camera->max_depth = c.max_depth;
+    memcpy(output_name, c.output_name, CHARARRAY_LEN);
+    output_name[CHARARRAY_LEN - 1] = '\0';
+
+    // Replaces the default material Reset() made; the table starts with the one the text loader kept.
+    for (Material* mat : materials) {
+        delete mat;
+    }
+    materials.clear();
+    // Records with the same parameters share one material, like InternMaterial() would, but keep their ids.
+    vector<Material*> file_materials;
+    file_materials.reserve(header->materials.count);
+    for (uint64_t i = 0; i < header->materials.count; i++) {
+        const P3bMaterial& m = in_materials[i];
+        Material mat(m.id);
+        mat.ambient = ToColor(m.ambient);
+        mat.diffuse = ToColor(m.diffuse);
+        mat.specular = ToColor(m.specular);
+        mat.transmissive = ToColor(m.transmissive);
+        mat.phong = m.phong;
+        mat.ior = m.ior;
+        auto found = find_if(materials.begin(), materials.end(), [&mat](Material* other) { return other->Matches(mat); });
+        if (found == materials.end()) {
+            materials.push_back(new Material(mat));
+            found = materials.end() - 1;
+        }
+        file_materials.push_back(*found);
+    }
+
+    shared_ptr<vector<vec3>> positions = make_shared<vector<vec3>>();
+    shared_ptr<vector<vec3>> normals = make_shared<vector<vec3>>();
+    CopyVectors(in_vertices, vertex_count, *positions);
+    CopyVectors(in_normals, normal_count, *normals);
+
+    size_t triangle_count = 0, mesh_count = 0;
+    for (uint64_t i = 0; i < header->shapes.count; i++) {
+        const P3bShape& s = in_shapes[i];
+        Material* mat = file_materials[s.material];
+        switch (s.type) {
+            case P3B_SPHERE: {
+                Sphere* sphere = new Sphere(s.id, mat);
+                sphere->position = ToVec3(s.position);
+                sphere->radius = s.radius;
+                shapes.push_back(sphere);
+                break;
+            }
+            case P3B_TRIANGLE: {
+                Triangle* tri = new Triangle(s.id, mat);
+                tri->v1 = (*positions)[s.first];
+                tri->v2 = (*positions)[s.first + 1];
+                tri->v3 = (*positions)[s.first + 2];
+                shapes.push_back(tri);
+                break;
+            }
+            case P3B_NORMAL_TRIANGLE: {
+                NormalTriangle* tri = new NormalTriangle(s.id, mat);
+                tri->v1 = (*positions)[s.first];
+                tri->v2 = (*positions)[s.first + 1];
+                tri->v3 = (*positions)[s.first + 2];
+                tri->n1 = (*normals)[s.normal_first];
+                tri->n2 = (*normals)[s.normal_first + 1];
+                tri->n3 = (*normals)[s.normal_first + 2];
+                shapes.push_back(tri);
+                break;
+            }
+            case P3B_MESH: {
+                Mesh* mesh = new Mesh(s.id, mat);
+                mesh->smooth = s.smooth;
+                mesh->positions = positions;
+                mesh->normals = normals;
+                mesh->vertex_indices.assign(vertex_indices + s.first, vertex_indices + s.first + s.count);
+                if (s.smooth)
+                    mesh->normal_indices.assign(normal_indices + s.normal_first, normal_indices + s.normal_first + s.count);
+                shapes.push_back(mesh);
+                triangle_count += mesh->TriangleCount();
+                mesh_count++;
+                break;
+            }
+            case P3B_SPHERE_CLOUD: {
+                SphereCloud* cloud = new SphereCloud(s.id, mat);
+                cloud->centers.reserve(s.count);
+                cloud->radii.reserve(s.count);
+                for (uint32_t j = s.first; j < s.first + s.count; j++) {
+                    cloud->centers.push_back(ToVec3(in_spheres[j].position));
+                    cloud->radii.push_back(in_spheres[j].radius);
+                }
+                shapes.push_back(cloud);
+                break;
+            }
+        }
+    }
+
+    for (uint64_t i = 0; i < header->lights.count; i++) {
+        const P3bLight& l = in_lights[i];
+        Light* light = NULL;
+        switch (l.type) {
+            case P3B_AMBIENT_LIGHT:
+                light = new AmbientLight(l.id);
+                break;
+            case P3B_DIRECTIONAL_LIGHT: {
+                DirectionalLight* directional = new DirectionalLight(l.id);
+                directional->direction = ToVec3(l.direction);
+                light = directional;
+                break;
+            }
+            case P3B_POINT_LIGHT: {
+                PointLight* point = new PointLight(l.id);
+                point->position = ToVec3(l.position);
+                light = point;
+                break;
+            }
+            case P3B_SPOT_LIGHT: {
+                SpotLight* spot = new SpotLight(l.id);
+                spot->position = ToVec3(l.position);
+                spot->direction = ToVec3(l.direction);
+                spot->angle1 = l.angle1;
+                spot->angle2 = l.angle2;
+                light = spot;
+                break;
+            }
+        }
+        if (light == NULL)
+            continue;
+        light->color = ToColor(l.color);
+        light->mult = l.mult;
+        lights.push_back(light);
+    }
+    entity_count = header->entity_count;
+
+    if (mesh_count > 0)
+        Log("Loaded " + to_string(triangle_count) + " triangles into " + to_string(mesh_count) + " meshes");
+    float load_s = duration<float>(steady_clock::now() - load_start).count();
+    float megabytes = file.size / (1024.0f * 1024.0f);
+    Log("Read " + to_string(megabytes) + "MB in " + to_string(load_s) + "s, " + to_string(megabytes / fmax(load_s, 1e-6)) + " MB/s");
+    return true;
+}
+
+// Appends a section to the file image, padded so the next one starts 8 byte aligned.
+template <class T>
+static P3bSection WriteSection(string& out, const vector<T>& records) {
+    P3bSection section{out.size(), records.size()};
+    out.append((const char*)records.data(), records.size() * sizeof(T));
+    out.resize((out.size() + 7) & ~(size_t)7, '\0');
+    return section;
+}
+
+bool SaveBinaryFile(const string& path) {
+    // The format has no records for objects, and a file without them would load as a different scene.
+    if (!prototypes.empty()) {
+        Log(path + " not written, binary scenes can't hold instanced objects");
+        return false;
+    }
+
+    P3bHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, P3B_MAGIC, 4);
+    header.version = P3B_VERSION;
+    header.entity_count = entity_count;
+
+    P3bCamera& c = header.camera;
+    c.id = camera->id;
+    c.position = ToP3b(camera->position);
+    c.forward = ToP3b(camera->forward);
+    c.up = ToP3b(camera->up);
+    c.background = ToP3b(camera->background_color);
+    c.half_vfov = camera->half_vfov;
+    c.res_x = camera->res.x;
+    c.res_y = camera->res.y;
+    c.max_depth = camera->max_depth;
+    strncpy(c.output_name, output_name, P3B_OUTPUT_NAME_LEN - 1);
+
+    vector<P3bMaterial> out_materials;
+    unordered_map<const Material*, uint32_t> material_index;
+    auto add_material = [&](const Material* mat) {
+        auto found = material_index.find(mat);
+        if (found != material_index.end())
+            return found->second;
+        P3bMaterial m;
+        m.id = mat->id;
+        m.ambient = ToP3b(mat->ambient);
+        m.diffuse = ToP3b(mat->diffuse);
+        m.specular = ToP3b(mat->specular);
+        m.transmissive = ToP3b(mat->transmissive);
+        m.phong = mat->phong;
+        m.ior = mat->ior;
+        out_materials.push_back(m);
+        return material_index[mat] = out_materials.size() - 1;
+    };
+    for (Material* mat : materials) {
+        add_material(mat);
+    }
+
+    // Meshes loaded together share their buffers, which are written once and indexed from where they start.
+    vector<P3bVec3> out_vertices, out_normals;
+    unordered_map<const vector<vec3>*, uint32_t> buffer_start;
+    auto add_buffer = [&](const shared_ptr<const vector<vec3>>& buffer, vector<P3bVec3>& out) -> uint32_t {
+        if (!buffer)
+            return 0;
+        auto found = buffer_start.find(buffer.get());
+        if (found != buffer_start.end())
+            return found->second;
+        uint32_t start = out.size();
+        for (const vec3& v : *buffer) {
+            out.push_back(ToP3b(v));
+        }
+        return buffer_start[buffer.get()] = start;
+    };
+
+    vector<P3bShape> out_shapes;
+    vector<uint32_t> out_vertex_indices, out_normal_indices;
+    vector<P3bSphere> out_spheres;
+    for (Geometry* geo : shapes) {
+        P3bShape s;
+        memset(&s, 0, sizeof(s));
+        s.id = geo->id;
+        s.material = add_material(geo->material);
+        if (Mesh* mesh = dynamic_cast<Mesh*>(geo)) {
+            s.type = P3B_MESH;
+            s.smooth = mesh->smooth;
+            s.first = out_vertex_indices.size();
+            s.count = mesh->vertex_indices.size();
+            uint32_t start = add_buffer(mesh->positions, out_vertices);
+            for (uint32_t i : mesh->vertex_indices) {
+                out_vertex_indices.push_back(start + i);
+            }
+            if (mesh->smooth) {
+                s.normal_first = out_normal_indices.size();
+                start = add_buffer(mesh->normals, out_normals);
+                for (uint32_t i : mesh->normal_indices) {
+                    out_normal_indices.push_back(start + i);
+                }
+            }
+        } else if (SphereCloud* cloud = dynamic_cast<SphereCloud*>(geo)) {
+            s.type = P3B_SPHERE_CLOUD;
+            s.first = out_spheres.size();
+            s.count = cloud->SphereCount();
+            for (int i = 0; i < cloud->SphereCount(); i++) {
+                out_spheres.push_back(P3bSphere{ToP3b(cloud->centers[i]), cloud->radii[i]});
+            }
+        } else if (NormalTriangle* tri = dynamic_cast<NormalTriangle*>(geo)) {
+            s.type = P3B_NORMAL_TRIANGLE;
+            s.first = out_vertices.size();
+            s.normal_first = out_normals.size();
+            out_vertices.insert(out_vertices.end(), {ToP3b(tri->v1), ToP3b(tri->v2), ToP3b(tri->v3)});
+            out_normals.insert(out_normals.end(), {ToP3b(tri->n1), ToP3b(tri->n2), ToP3b(tri->n3)});
+        } else if (Triangle* tri = dynamic_cast<Triangle*>(geo)) {
+            s.type = P3B_TRIANGLE;
+            s.first = out_vertices.size();
+            out_vertices.insert(out_vertices.end(), {ToP3b(tri->v1), ToP3b(tri->v2), ToP3b(tri->v3)});
+        } else if (Sphere* sphere = dynamic_cast<Sphere*>(geo)) {
+            s.type = P3B_SPHERE;
+            s.position = ToP3b(sphere->position);
+            s.radius = sphere->radius;
+        } else {
+            continue;
+        }
+        out_shapes.push_back(s);
+    }
+
+    vector<P3bLight> out_lights;
+    for (Light* light : lights) {
+        P3bLight l;
+        memset(&l, 0, sizeof(l));
+        l.id = light->id;
+        l.color = ToP3b(light->color);
+        l.mult = light->mult;
+        if (dynamic_cast<AmbientLight*>(light)) {
+            l.type = P3B_AMBIENT_LIGHT;
+        } else if (DirectionalLight* directional = dynamic_cast<DirectionalLight*>(light)) {
+            l.type = P3B_DIRECTIONAL_LIGHT;
+            l.direction = ToP3b(directional->direction);
+        } else if (PointLight* point = dynamic_cast<PointLight*>(light)) {
+            l.type = P3B_POINT_LIGHT;
+            l.position = ToP3b(point->position);
+        } else if (SpotLight* spot = dynamic_cast<SpotLight*>(light)) {
+            l.type = P3B_SPOT_LIGHT;
+            l.position = ToP3b(spot->position);
+            l.direction = ToP3b(spot->direction);
+            l.angle1 = spot->angle1;
+            l.angle2 = spot->angle2;
+        } else {
+            continue;
+        }
+        out_lights.push_back(l);
+    }
+
+    string out((sizeof(P3bHeader) + 7) & ~(size_t)7, '\0');
+    header.materials = WriteSection(out, out_materials);
+    header.shapes = WriteSection(out, out_shapes);
+    header.lights = WriteSection(out, out_lights);
+    header.vertices = WriteSection(out, out_vertices);
+    header.normals = WriteSection(out, out_normals);
+    header.vertex_indices = WriteSection(out, out_vertex_indices);
+    header.normal_indices = WriteSection(out, out_normal_indices);
+    header.spheres = WriteSection(out, out_spheres);
+    memcpy(&out[0], &header, sizeof(header));
+
+    ofstream scene_file(path, ios::binary);
+    if (!scene_file.is_open())
+        return false;
+    scene_file.write(out.data(), out.size());
+    return scene_file.good();
+}
+
+}  // namespace Raytracer
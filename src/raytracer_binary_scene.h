@@ -0,0 +1,100 @@
+#ifndef _RAYTRACER_BINARY_SCENE_H
+#define _RAYTRACER_BINARY_SCENE_H
+
+#include <stdint.h>
+
+// Layout of .p3b scene files, which hold the scene exactly as loading the .p3 text leaves it.
+// A header followed by flat arrays of the records below, each starting at an 8 byte aligned offset, so a
+// mapped file is read in place. Little endian, like every platform the raytracer builds on.
+// Bump P3B_VERSION whenever a record changes; older files are refused rather than misread.
+#define P3B_VERSION 2
+#define P3B_OUTPUT_NAME_LEN 256
+
+namespace Raytracer {
+
+enum P3bShapeType : uint32_t {
+    P3B_SPHERE,
+    P3B_TRIANGLE,
+    P3B_NORMAL_TRIANGLE,
+    P3B_MESH,
+    P3B_SPHERE_CLOUD
+};
+
+enum P3bLightType : uint32_t {
+    P3B_AMBIENT_LIGHT,
+    P3B_DIRECTIONAL_LIGHT,
+    P3B_POINT_LIGHT,
+    P3B_SPOT_LIGHT
+};
+
+struct P3bVec3 {
+    float x, y, z;
+};
+
+// Where one array starts in the file and how many records it holds.
+struct P3bSection {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct P3bCamera {
+    int32_t id;
+    P3bVec3 position, forward, up;
+    P3bVec3 background;
+    float half_vfov;
+    int32_t res_x, res_y;
+    int32_t max_depth;
+    char output_name[P3B_OUTPUT_NAME_LEN];
+};
+
+struct P3bSphere {
+    P3bVec3 position;
+    float radius;
+};
+
+struct P3bMaterial {
+    int32_t id;
+    P3bVec3 ambient, diffuse, specular, transmissive;
+    float phong, ior;
+};
+
+struct P3bShape {
+    P3bShapeType type;
+    int32_t id;
+    // Index into the material table.
+    uint32_t material;
+    uint32_t smooth;
+    // Meshes use vertex indices [first, first + count) and, when smooth, normal indices [normal_first, normal_first + count).
+    // Triangles have their corners at vertices [first, first + 3) and normals [normal_first, normal_first + 3).
+    // Sphere clouds hold spheres [first, first + count).
+    uint32_t first, count, normal_first;
+    // Spheres only.
+    P3bVec3 position;
+    float radius;
+};
+
+struct P3bLight {
+    P3bLightType type;
+    int32_t id;
+    P3bVec3 color;
+    float mult;
+    P3bVec3 position, direction;
+    float angle1, angle2;
+};
+
+struct P3bHeader {
+    char magic[4];
+    uint32_t version;
+    // entity_count after loading, so objects created afterwards keep getting fresh ids.
+    int32_t entity_count;
+    uint32_t reserved;
+    P3bCamera camera;
+    P3bSection materials, shapes, lights;
+    P3bSection vertices, normals;
+    P3bSection vertex_indices, normal_indices;
+    P3bSection spheres;
+};
+
+}  // namespace Raytracer
+
+#endif
@@ -0,0 +1,354 @@
+// Binned SAH construction following Wald, "On fast Construction of SAH-based Bounding Volume Hierarchies" (2007).
+
+#include "raytracer_bvh.h"
+
+#include <algorithm>
+
+namespace Raytracer {
+
+static double Axis(const vec3& v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+void BVH::Build(const PrimitiveArrays& arrays) {
+    prims = &arrays;
+    nodes.clear();
+    primitives.clear();
+
+    vector<BuildPrim> build_prims;
+    for (uint32_t prim = 0; prim < arrays.Count(); prim++) {
+        BoundingBox bb = arrays.Bounds(prim);
+        build_prims.push_back(BuildPrim{bb, bb.Centroid(), prim});
+    }
+
+    if (!build_prims.empty()) {
+        // A binary tree with n leaves at most has 2n - 1 nodes.
+        nodes.reserve(2 * build_prims.size());
+        nodes.push_back(BVHNode{});
+        Subdivide(build_prims, 0, 0, build_prims.size(), 0);
+    }
+
+    primitives.reserve(build_prims.size());
+    for (BuildPrim& prim : build_prims) {
+        primitives.push_back(prim.prim);
+    }
+
+    packet_bounds.clear();
+    packet_bounds.reserve(nodes.size());
+    for (BVHNode& node : nodes) {
+        BVHPacketBounds pb;
+        for (int axis = 0; axis < 3; axis++) {
+            double lo = Axis(node.bounds.min, axis), hi = Axis(node.bounds.max, axis);
+            float pad = 1e-5f * (1.0f + fmax(fabs(lo), fabs(hi)));
+            pb.min[axis] = (float)lo - pad;
+            pb.max[axis] = (float)hi + pad;
+        }
+        packet_bounds.push_back(pb);
+    }
+}
+
+void BVH::Subdivide(vector<BuildPrim>& build_prims, int node_i, int first, int count, int depth) {
+    BoundingBox bounds = BoundingBox::Empty();
+    BoundingBox centroid_bounds = BoundingBox::Empty();
+    for (int i = first; i < first + count; i++) {
+        bounds.Extend(build_prims[i].bounds);
+        centroid_bounds.Extend(BoundingBox{build_prims[i].centroid, build_prims[i].centroid});
+    }
+    nodes[node_i].bounds = bounds;
+    nodes[node_i].offset = first;
+    nodes[node_i].count = count;
+
+    if (count == 1)
+        return;
+
+    // Find the cheapest binned split over all three axes.
+    int best_axis = -1;
+    int best_bin = 0;
+    float best_cost = INFINITY;
+    for (int axis = 0; axis < 3; axis++) {
+        double c_min = Axis(centroid_bounds.min, axis);
+        double c_extent = Axis(centroid_bounds.max, axis) - c_min;
+        if (c_extent <= 0)
+            continue;
+
+        int bin_count[BVH_BINS] = {0};
+        BoundingBox bin_bounds[BVH_BINS];
+        for (int b = 0; b < BVH_BINS; b++) bin_bounds[b] = BoundingBox::Empty();
+
+        double scale = BVH_BINS / c_extent;
+        for (int i = first; i < first + count; i++) {
+            int b = min(BVH_BINS - 1, (int)((Axis(build_prims[i].centroid, axis) - c_min) * scale));
+            bin_count[b]++;
+            bin_bounds[b].Extend(build_prims[i].bounds);
+        }
+
+        // Sweep from the right to get the cost of everything past each split plane.
+        float right_area[BVH_BINS];
+        int right_count[BVH_BINS];
+        BoundingBox right_box = BoundingBox::Empty();
+        int right_sum = 0;
+        for (int b = BVH_BINS - 1; b > 0; b--) {
+            right_box.Extend(bin_bounds[b]);
+            right_sum += bin_count[b];
+            right_area[b] = right_box.SurfaceArea();
+            right_count[b] = right_sum;
+        }
+
+        BoundingBox left_box = BoundingBox::Empty();
+        int left_sum = 0;
+        for (int b = 0; b < BVH_BINS - 1; b++) {
+            left_box.Extend(bin_bounds[b]);
+            left_sum += bin_count[b];
+            if (left_sum == 0 || right_count[b + 1] == 0)
+                continue;
+            float cost = left_box.SurfaceArea() * left_sum + right_area[b + 1] * right_count[b + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+
+    // Traversal and intersection are assumed to cost the same, so splitting must beat testing everything here.
+    float leaf_cost = bounds.SurfaceArea() * count;
+    float split_cost = bounds.SurfaceArea() + best_cost;
+    bool sah_wants_leaf = best_axis == -1 || split_cost >= leaf_cost;
+    if (sah_wants_leaf && count <= BVH_MAX_LEAF)
+        return;
+
+    int mid;
+    if (best_axis != -1 && !sah_wants_leaf && depth < BVH_SAH_DEPTH) {
+        double c_min = Axis(centroid_bounds.min, best_axis);
+        double scale = BVH_BINS / (Axis(centroid_bounds.max, best_axis) - c_min);
+        auto middle = partition(build_prims.begin() + first, build_prims.begin() + first + count,
+                                [&](const BuildPrim& p) {
+                                    int b = min(BVH_BINS - 1, (int)((Axis(p.centroid, best_axis) - c_min) * scale));
+                                    return b <= best_bin;
+                                });
+        mid = middle - build_prims.begin();
+    } else {
+        mid = first;
+    }
+    if (mid == first || mid == first + count) {
+        // Degenerate centroids or too deep: fall back to an object median on the widest axis.
+        vec3 extent = centroid_bounds.max - centroid_bounds.min;
+        int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+        mid = first + count / 2;
+        nth_element(build_prims.begin() + first, build_prims.begin() + mid, build_prims.begin() + first + count,
+                    [axis](const BuildPrim& a, const BuildPrim& b) {
+                        return Axis(a.centroid, axis) < Axis(b.centroid, axis);
+                    });
+    }
+
+    int left_i = nodes.size();
+    nodes.push_back(BVHNode{});
+    nodes.push_back(BVHNode{});
+    nodes[node_i].offset = left_i;
+    nodes[node_i].count = 0;
+
+    Subdivide(build_prims, left_i, first, mid - first, depth + 1);
+    Subdivide(build_prims, left_i + 1, mid, first + count - mid, depth + 1);
+}
+
+bool BVH::FindIntersection(const Ray& ray, HitInformation* intersection) {
+    if (nodes.empty())
+        return false;
+
+    vec3 inv_dir = vec3(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+    float closest = INFINITY;
+    float t_near;
+    if (!nodes[0].bounds.Intersect(ray.pos, inv_dir, closest, &t_near))
+        return false;
+
+    struct StackEntry {
+        int node;
+        float t_near;
+    };
+    StackEntry stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = StackEntry{0, t_near};
+
+    PrimitiveHit current_hit, best_hit;
+    bool hit = false;
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        // Something closer was found since this node was pushed.
+        if (entry.t_near > closest)
+            continue;
+
+        const BVHNode& node = nodes[entry.node];
+        if (node.count > 0) {
+            for (int i = node.offset; i < node.offset + node.count; i++) {
+                if (prims->Intersect(primitives[i], ray, &current_hit) && current_hit.t < closest) {
+                    best_hit = current_hit;
+                    closest = current_hit.t;
+                    hit = true;
+                }
+            }
+            continue;
+        }
+
+        float t_left, t_right;
+        bool hit_left = nodes[node.offset].bounds.Intersect(ray.pos, inv_dir, closest, &t_left);
+        bool hit_right = nodes[node.offset + 1].bounds.Intersect(ray.pos, inv_dir, closest, &t_right);
+        // Push the far child first so the near one is visited first.
+        if (hit_left && hit_right) {
+            if (t_left < t_right) {
+                stack[stack_size++] = StackEntry{node.offset + 1, t_right};
+                stack[stack_size++] = StackEntry{node.offset, t_left};
+            } else {
+                stack[stack_size++] = StackEntry{node.offset, t_left};
+                stack[stack_size++] = StackEntry{node.offset + 1, t_right};
+            }
+        } else if (hit_left) {
+            stack[stack_size++] = StackEntry{node.offset, t_left};
+        } else if (hit_right) {
+            stack[stack_size++] = StackEntry{node.offset + 1, t_right};
+        }
+    }
+    if (hit)
+        prims->Resolve(ray, best_hit, intersection);
+    return hit;
+}
+
+// Slab test of every lane against one box. Returns the lanes that reach it before closest.
+static int PacketIntersect(const BVHPacketBounds& b, const vfloat* pos, const vfloat* inv_dir, vfloat closest,
+                           vfloat* t_near) {
+    vfloat t1 = (vfloat(b.min[0]) - pos[0]) * inv_dir[0], t2 = (vfloat(b.max[0]) - pos[0]) * inv_dir[0];
+    vfloat t_enter = vmin(t1, t2), t_exit = vmax(t1, t2);
+    for (int axis = 1; axis < 3; axis++) {
+        t1 = (vfloat(b.min[axis]) - pos[axis]) * inv_dir[axis];
+        t2 = (vfloat(b.max[axis]) - pos[axis]) * inv_dir[axis];
+        t_enter = vmax(t_enter, vmin(t1, t2));
+        t_exit = vmin(t_exit, vmax(t1, t2));
+    }
+    *t_near = t_enter;
+    return ((t_enter <= t_exit) & (t_exit >= vfloat(0.0f)) & (t_enter <= closest)).Bits();
+}
+
+// Masked packet traversal: a node is visited while any lane still reaches it, and leaves are
+// tested only for those lanes. Primitive tests stay scalar so hits match the single ray path.
+int BVH::FindIntersection(const RayPacket& packet, HitInformation* hits) {
+    if (nodes.empty() || !packet.active)
+        return 0;
+
+    vfloat pos[3], inv_dir[3];
+    for (int axis = 0; axis < 3; axis++) {
+        pos[axis] = vfloat::Load(packet.pos[axis]);
+        inv_dir[axis] = vfloat::Load(packet.inv_dir[axis]);
+    }
+    SIMD_ALIGN float closest[SIMD_WIDTH];
+    for (int lane = 0; lane < SIMD_WIDTH; lane++) closest[lane] = INFINITY;
+
+    vfloat t_near;
+    int mask = PacketIntersect(packet_bounds[0], pos, inv_dir, vfloat(INFINITY), &t_near) & packet.active;
+    if (!mask)
+        return 0;
+
+    struct StackEntry {
+        vfloat t_near;
+        int node;
+        int mask;
+    };
+    StackEntry stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = StackEntry{t_near, 0, mask};
+
+    PrimitiveHit current_hit, best_hits[SIMD_WIDTH];
+    int hit_mask = 0;
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        // Drop the lanes that found something closer since this node was pushed.
+        mask = entry.mask & (entry.t_near <= vfloat::Load(closest)).Bits();
+        if (!mask)
+            continue;
+
+        const BVHNode& node = nodes[entry.node];
+        if (node.count > 0) {
+            for (int i = node.offset; i < node.offset + node.count; i++) {
+                uint32_t prim = primitives[i];
+                for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+                    if (!(mask & (1 << lane)))
+                        continue;
+                    if (prims->Intersect(prim, packet.rays[lane], &current_hit) &&
+                        current_hit.t < closest[lane]) {
+                        best_hits[lane] = current_hit;
+                        closest[lane] = current_hit.t;
+                        hit_mask |= 1 << lane;
+                    }
+                }
+            }
+            continue;
+        }
+
+        vfloat t_left, t_right;
+        vfloat closest_v = vfloat::Load(closest);
+        int mask_left = PacketIntersect(packet_bounds[node.offset], pos, inv_dir, closest_v, &t_left) & mask;
+        int mask_right = PacketIntersect(packet_bounds[node.offset + 1], pos, inv_dir, closest_v, &t_right) & mask;
+        StackEntry left{t_left, node.offset, mask_left};
+        StackEntry right{t_right, node.offset + 1, mask_right};
+        int both = mask_left & mask_right;
+        if (both) {
+            // The rays are coherent, so the first lane reaching both decides the order for all of them.
+            int lane = 0;
+            while (!(both & (1 << lane))) lane++;
+            SIMD_ALIGN float near_left[SIMD_WIDTH], near_right[SIMD_WIDTH];
+            t_left.Store(near_left);
+            t_right.Store(near_right);
+            if (near_left[lane] < near_right[lane]) {
+                stack[stack_size++] = right;
+                stack[stack_size++] = left;
+            } else {
+                stack[stack_size++] = left;
+                stack[stack_size++] = right;
+            }
+        } else {
+            if (mask_right) stack[stack_size++] = right;
+            if (mask_left) stack[stack_size++] = left;
+        }
+    }
+    for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+        if (hit_mask & (1 << lane))
+            prims->Resolve(packet.rays[lane], best_hits[lane], &hits[lane]);
+    }
+    return hit_mask;
+}
+
+bool BVH::Occluded(const Ray& ray, float t_max) {
+    if (nodes.empty())
+        return false;
+
+    // Any blocker will do, so children are visited in storage order.
+    vec3 inv_dir = vec3(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+    int stack[BVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    float t_near;
+    while (stack_size > 0) {
+        const BVHNode& node = nodes[stack[--stack_size]];
+        if (!node.bounds.Intersect(ray.pos, inv_dir, t_max, &t_near))
+            continue;
+
+        if (node.count > 0) {
+            for (int i = node.offset; i < node.offset + node.count; i++) {
+                if (prims->Occluded(primitives[i], ray, t_max))
+                    return true;
+            }
+            continue;
+        }
+        stack[stack_size++] = node.offset + 1;
+        stack[stack_size++] = node.offset;
+    }
+    return false;
+}
+
+string BVH::Stats() {
+    size_t bytes = nodes.size() * sizeof(BVHNode) + packet_bounds.size() * sizeof(BVHPacketBounds) +
+                   primitives.size() * sizeof(uint32_t);
+    return "BVH: " + to_string(nodes.size()) + " nodes over " + to_string(primitives.size()) + " primitives, " +
+           to_string(primitives.empty() ? 0 : bytes / primitives.size()) + " bytes per primitive";
+}
+
+}  // namespace Raytracer
@@ -0,0 +1,62 @@
+#ifndef _RAYTRACER_BVH_H
+#define _RAYTRACER_BVH_H
+
+#include <vector>
+#include <vec3.h>
+
+#include "raytracer_accelerator.h"
+
+// Split candidates evaluated per axis when building.
+#define BVH_BINS 12
+// Leaves are only forced to split when they hold more than this.
+#define BVH_MAX_LEAF 8
+// Past this depth we stop trusting SAH and split at the median, which bounds tree depth.
+#define BVH_SAH_DEPTH 32
+#define BVH_STACK_SIZE 64
+
+using namespace std;
+
+namespace Raytracer {
+
+struct BVHNode {
+    BoundingBox bounds;
+    // Interior: index of the left child, the right child is always left + 1.
+    // Leaf: index of the first primitive in BVH::primitives.
+    int offset;
+    // 0 for interior nodes.
+    int count;
+};
+
+// Node bounds in single precision for packet traversal, padded outward so rounding never loses a hit.
+struct BVHPacketBounds {
+    float min[3];
+    float max[3];
+};
+
+// Bounding volume hierarchy over primitive bounding boxes, built with the binned surface area heuristic.
+struct BVH : Accelerator {
+    vector<BVHNode> nodes;
+    // Primitive indices reordered so every leaf owns a contiguous range.
+    vector<uint32_t> primitives;
+    // Parallel to nodes.
+    vector<BVHPacketBounds> packet_bounds;
+
+    void Build(const PrimitiveArrays& arrays);
+    bool FindIntersection(const Ray& ray, HitInformation* intersection);
+    int FindIntersection(const RayPacket& packet, HitInformation* hits);
+    bool Occluded(const Ray& ray, float t_max);
+    string Stats();
+
+  private:
+    struct BuildPrim {
+        BoundingBox bounds;
+        vec3 centroid;
+        uint32_t prim;
+    };
+
+    void Subdivide(vector<BuildPrim>& build_prims, int node_i, int first, int count, int depth);
+};
+
+}  // namespace Raytracer
+
+#endif
@@ -0,0 +1,144 @@
+// Headless renderer for batch and benchmark runs. Loads a scene, renders it and writes the image
+// without SDL, OpenGL or ImGui. Built by the Makefile in the repository root; the editor is Project3.sln.
+
+#include "raytracer_render.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace Raytracer;
+
+static void PrintUsage() {
+    printf("usage: raytracer_cli <scene.p3> [-o image] [-r WxH] [-t threads] [-s samples] [-a accelerator] [-l lights] [-w]\n");
+    printf("       raytracer_cli <scene.p3> -c <scene.p3b>\n");
+    printf("  -o  image to write, bmp/png/jpg/tga by extension (default: output/<output_image of the scene>)\n");
+    printf("  -r  resolution, overriding the scene's film_resolution\n");
+    printf("  -t  render threads (default: all hardware threads)\n");
+    printf("  -s  samples per pixel: 0 one centered, -1 five fixed, -2 adaptive, n > 0 n quasi-random (default: %d)\n", SAMPLING);
+    printf("  -m  adaptive sampling: most samples of one pixel (default: %d)\n", ADAPTIVE_MAX_SAMPLES);
+    printf("  -e  adaptive sampling: luminance difference that earns a pixel more samples (default: %g)\n", ADAPTIVE_THRESHOLD);
+    printf("  -a  accelerator: none, bvh, grid or widebvh (default: %s)\n", accelerator_names[accelerator_type]);
+    printf("  -l  lights to shade each hit with: all, sampled or topk (default: all)\n");
+    printf("  -k  point and spot lights per hit for -l sampled and -l topk (default: %d)\n", LIGHT_COUNT);
+    printf("  -w  trace a stage at a time with the wavefront path (default: %s)\n", WAVEFRONT ? "on" : "off");
+    printf("  -c  convert the scene to a binary .p3b instead of rendering it\n");
+}
+
+// Accelerator names compared without case or spaces, so "widebvh" finds "Wide BVH".
+static int FindAccelerator(const char* name) {
+    for (int i = 0; i < ACCEL_COUNT; i++) {
+        const char* a = accelerator_names[i];
+        const char* b = name;
+        while (*a || *b) {
+            if (*a == ' ') { a++; continue; }
+            if (*b == ' ') { b++; continue; }
+            if (tolower(*a) != tolower(*b)) break;
+            a++;
+            b++;
+        }
+        if (!*a && !*b)
+            return i;
+    }
+    return -1;
+}
+
+static void PrintLog() {
+    for (string& s : debug_log) {
+        printf("%s\n", s.c_str());
+    }
+    debug_log.clear();
+}
+
+int main(int argc, char** argv) {
+    const char* scene_path = NULL;
+    const char* image_path = NULL;
+    const char* convert_path = NULL;
+    int width = 0, height = 0;
+    render_threads = HardwareThreads();
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-o" && has_value) {
+            image_path = argv[++i];
+        } else if (arg == "-c" && has_value) {
+            convert_path = argv[++i];
+        } else if (arg == "-r" && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width < 1 || height < 1) {
+                PrintUsage();
+                return 1;
+            }
+        } else if (arg == "-t" && has_value) {
+            render_threads = atoi(argv[++i]);
+        } else if (arg == "-s" && has_value) {
+            sampling = atoi(argv[++i]);
+        } else if (arg == "-m" && has_value) {
+            adaptive_max_samples = atoi(argv[++i]);
+        } else if (arg == "-e" && has_value) {
+            adaptive_threshold = atof(argv[++i]);
+        } else if (arg == "-l" && has_value) {
+            string mode = argv[++i];
+            if (mode == "all") {
+                light_selection = LIGHTS_ALL;
+            } else if (mode == "sampled") {
+                light_selection = LIGHTS_SAMPLED;
+            } else if (mode == "topk") {
+                light_selection = LIGHTS_TOP_K;
+            } else {
+                fprintf(stderr, "unknown light selection %s\n", argv[i]);
+                return 1;
+            }
+        } else if (arg == "-k" && has_value) {
+            light_count = atoi(argv[++i]);
+        } else if (arg == "-w") {
+            wavefront = true;
+        } else if (arg == "-a" && has_value) {
+            accelerator_type = FindAccelerator(argv[++i]);
+            if (accelerator_type == -1) {
+                fprintf(stderr, "unknown accelerator %s\n", argv[i]);
+                return 1;
+            }
+        } else if (arg[0] != '-' && scene_path == NULL) {
+            scene_path = argv[i];
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+    if (scene_path == NULL || render_threads < 1 || sampling < AA_ADAPTIVE || adaptive_max_samples < 1 || light_count < 1) {
+        PrintUsage();
+        return 1;
+    }
+
+    steady_clock::time_point load_start = steady_clock::now();
+    if (!LoadFile(scene_path)) {
+        fprintf(stderr, "could not open %s\n", scene_path);
+        return 1;
+    }
+    float load_s = duration<float>(steady_clock::now() - load_start).count();
+    PrintLog();
+    if (convert_path != NULL) {
+        if (!SaveBinaryFile(convert_path)) {
+            fprintf(stderr, "could not write %s\n", convert_path);
+            return 1;
+        }
+        printf("%s: load %.3fs, wrote %s\n", scene_path, load_s, convert_path);
+        return 0;
+    }
+    if (width > 0) {
+        camera->res = vec3i(width, height, 0);
+    }
+
+    Image image(camera->res.x, camera->res.y);
+    steady_clock::time_point render_start = steady_clock::now();
+    RenderImage(*TakeSnapshot(), &image);
+    float render_s = duration<float>(steady_clock::now() - render_start).count();
+    PrintLog();
+
+    string out = image_path ? string(image_path) : "output/" + string(output_name);
+    image.write(out.c_str());
+    printf("%s: %dx%d, %d threads, load %.3fs, render %.3fs, wrote %s\n", scene_path, camera->res.x, camera->res.y,
+           render_threads, load_s, render_s, out.c_str());
+    return 0;
+}
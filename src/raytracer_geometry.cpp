@@ -1,5 +1,8 @@
 #include "raytracer_geometry.h"
 
+#include <algorithm>
+#include "raytracer_primitives.h"
+
 namespace Raytracer {
 
 Geometry::Geometry(int* entity_count, Material* mat) : Object(entity_count) {
@@ -10,24 +13,38 @@ Geometry::Geometry(int old_id, Material* mat) : Object(old_id) {
 	material = mat;
 }
 
-bool Sphere::FindIntersection(Ray ray, HitInformation* intersection) {
+bool SphereRecord::Intersect(const Ray& ray, float* t) const {
     vec3 toStart = (ray.pos - position);
-    float b = 2.0 * dot(ray.dir, toStart);
-    float c = dot(toStart, toStart) - pow(radius, 2);
-    float discr = pow(b, 2) - 4.0 * c;
+    float b = 2.0f * dot(ray.dir, toStart);
+    float c = dot(toStart, toStart) - radius * radius;
+    float discr = b * b - 4.0f * c;
 
 	// no solutions to quadratic equation
     if (discr < 0)
         return false;
 
 	// t is the distance to the solutions of the line sphere intersection
-    float t0 = (-b + sqrt(discr)) / 2.0;
-    float t1 = (-b - sqrt(discr)) / 2.0;
+    float root = sqrtf(discr);
+    float t0 = (-b + root) * 0.5f;
+    float t1 = (-b - root) * 0.5f;
     float t_min = (RAY_EPSILON < t1 && t1 < t0) ? t1 : t0;
 
     if (t_min < RAY_EPSILON)
         return false;
 
+    *t = t_min;
+    return true;
+}
+
+bool Sphere::Intersect(const Ray& ray, float* t) {
+    return SphereRecord{position, radius}.Intersect(ray, t);
+}
+
+bool Sphere::FindIntersection(Ray ray, HitInformation* intersection) {
+    float t_min;
+    if (!Intersect(ray, &t_min))
+        return false;
+
     vec3 hit_pos = ray.pos + t_min * ray.dir;
     vec3 hit_norm = (hit_pos - position).normalized();
     *intersection = HitInformation{t_min, hit_pos, ray.dir, hit_norm, material};
@@ -35,93 +52,289 @@ bool Sphere::FindIntersection(Ray ray, HitInformation* intersection) {
     return true;
 }
 
-// OPTIMIZATION: 
-bool Triangle::FindIntersection(Ray ray, HitInformation* intersection) {
-	// Doesn't really matter how we do this. This gives us CCW winding.
-    vec3 edge1 = v2 - v1;
-    vec3 edge2 = v3 - v1;
+bool Sphere::Occluded(Ray ray, float t_max) {
+    float t;
+    return Intersect(ray, &t) && t < t_max;
+}
+
+TriangleRecord::TriangleRecord(const vec3& a, const vec3& b, const vec3& c) {
+	v1 = a;
+	edge1 = b - a;
+	edge2 = c - a;
+	normal = cross(edge1, edge2).normalized();
+}
 
-    vec3 norm = cross(edge1, edge2).normalized();
-    double dvn = dot(ray.dir, norm);
-    if (dvn == 0) return false; // Parallel
-    double t = -(dot(ray.pos, norm) + -dot(norm, v1)) / dvn;
-    vec3 plane_point = ray.pos + ray.dir * t;
+// Moller and Trumbore, "Fast, Minimum Storage Ray/Triangle Intersection" (1997).
+bool TriangleRecord::Intersect(const Ray& ray, float* t, float* u, float* v) const {
+	vec3 p = cross(ray.dir, edge2);
+	float det = dot(edge1, p);
+	if (det == 0) return false; // Parallel
+	float inv_det = 1.0f / det;
 
+	vec3 to_origin = ray.pos - v1;
+	float bu = dot(to_origin, p) * inv_det;
+	if (bu < 0 || bu > 1) return false;
+
+	vec3 q = cross(to_origin, edge1);
+	float bv = dot(ray.dir, q) * inv_det;
+	if (bv < 0 || bu + bv > 1) return false;
+
+	float bt = dot(edge2, q) * inv_det;
 	// intersection is behind point
-	if (t <= RAY_EPSILON) return false;
-    // intersection outside of point
-    bool same_side_v1 = same_side(plane_point, v1, v2, v3);
-    bool same_side_v2 = same_side(plane_point, v2, v1, v3);
-    bool same_side_v3 = same_side(plane_point, v3, v1, v2);
-    if (!same_side_v1 || !same_side_v2 || !same_side_v3)
+	if (bt <= RAY_EPSILON) return false;
+
+	*t = bt;
+	*u = bu;
+	*v = bv;
+	return true;
+}
+
+bool Triangle::FindIntersection(Ray ray, HitInformation* intersection) {
+    float t, u, v;
+    if (!record.Intersect(ray, &t, &u, &v))
         return false;
 
-	intersection->pos = plane_point;
+	intersection->pos = ray.pos + ray.dir * t;
 	intersection->dist = t;
 	intersection->material = material;
     intersection->viewing = ray.dir;
-	intersection->normal = dvn < 0 ? norm : -norm;
+	intersection->normal = dot(ray.dir, record.normal) < 0 ? record.normal : -record.normal;
 	return true;
 }
 
-// TODO: aint too happy that this doesn't reuse code. Finding the plane point is mutual.
-bool NormalTriangle::FindIntersection(Ray ray, HitInformation* intersection) {
-    vec3 edge1 = v2 - v1;
-    vec3 edge2 = v3 - v1;
-
-    vec3 norm = cross(edge1, edge2);
-    float d = (dot(ray.dir, norm));
-    if (d == 0) return false; // Parallel
-
-    float t = -(dot(ray.pos, norm) + -dot(norm, v1)) / d;
-    // intersection is behind point
-    if (t <= RAY_EPSILON) return false;
-
-    vec3 plane_point = ray.pos + ray.dir * t;
+bool Triangle::Occluded(Ray ray, float t_max) {
+    float t, u, v;
+    return record.Intersect(ray, &t, &u, &v) && t < t_max;
+}
 
-    // check if intersection outside of point
-	float triangle_area = norm.mag();
-	float area_1 = cross(v2 - v3, plane_point - v3).mag() / triangle_area;
-	float area_2 = cross(v3 - v1, plane_point - v1).mag() / triangle_area;
-    float area_3 = cross(v1 - v2, plane_point - v2).mag() / triangle_area;
-	if (area_1 > 1 || area_2 > 1 || area_3 > 1 || (area_1+area_2+area_3) > (1 + 100*FLT_EPSILON)) return false;
+bool NormalTriangle::FindIntersection(Ray ray, HitInformation* intersection) {
+    float t, u, v;
+    if (!record.Intersect(ray, &t, &u, &v))
+        return false;
 
-    intersection->pos = plane_point;
+    intersection->pos = ray.pos + ray.dir * t;
     intersection->dist = t;
     intersection->material = material;
     intersection->viewing = ray.dir;
-	vec3 out_norm = n1*area_1 + n2*area_2 + n3*area_3;
+	vec3 out_norm = n1*(1 - u - v) + n2*u + n3*v;
     intersection->normal = out_norm;
     return true;
 }
 
+bool Mesh::IntersectPrimitive(int prim, const Ray& ray, HitInformation* intersection) {
+	const TriangleRecord& record = records[prim];
+	float t, u, v;
+	if (!record.Intersect(ray, &t, &u, &v))
+		return false;
+
+	if (smooth)
+		intersection->normal = Normal(prim, 0) * (1 - u - v) + Normal(prim, 1) * u + Normal(prim, 2) * v;
+	else
+		intersection->normal = dot(ray.dir, record.normal) < 0 ? record.normal : -record.normal;
+	intersection->dist = t;
+	intersection->pos = ray.pos + ray.dir * t;
+	intersection->material = material;
+	intersection->viewing = ray.dir;
+	return true;
+}
+
+bool Mesh::OccludedPrimitive(int prim, const Ray& ray, float t_max) {
+	float t, u, v;
+	return records[prim].Intersect(ray, &t, &u, &v) && t < t_max;
+}
+
+bool Mesh::FindIntersection(Ray ray, HitInformation* intersection) {
+	HitInformation current_inter;
+	bool hit = false;
+	for (int i = 0; i < TriangleCount(); i++) {
+		if (IntersectPrimitive(i, ray, &current_inter) && (!hit || current_inter.dist < intersection->dist)) {
+			*intersection = current_inter;
+			hit = true;
+		}
+	}
+	return hit;
+}
+
+bool Mesh::Occluded(Ray ray, float t_max) {
+	for (int i = 0; i < TriangleCount(); i++) {
+		if (OccludedPrimitive(i, ray, t_max))
+			return true;
+	}
+	return false;
+}
+
+
+void Triangle::PreRender() {
+	record = TriangleRecord(v1, v2, v3);
+}
 
 void NormalTriangle::PreRender() {
+	Triangle::PreRender();
 	n1 = n1.normalized();
 	n2 = n2.normalized();
 	n3 = n3.normalized();
 }
 
+void Mesh::PreRender() {
+	records.resize(TriangleCount());
+	for (int i = 0; i < TriangleCount(); i++) {
+		records[i] = TriangleRecord(Vertex(i, 0), Vertex(i, 1), Vertex(i, 2));
+	}
+}
+
+
+void Sphere::AppendPrimitives(PrimitiveArrays* arrays) {
+	arrays->spheres.push_back(SphereRecord{position, radius});
+	arrays->sphere_materials.push_back(arrays->MaterialIndex(material));
+}
+
+void Triangle::AppendPrimitives(PrimitiveArrays* arrays) {
+	arrays->triangles.push_back(record);
+	arrays->triangle_materials.push_back(arrays->MaterialIndex(material));
+	arrays->triangle_corners.insert(arrays->triangle_corners.end(), {v1, v2, v3});
+}
+
+void NormalTriangle::AppendPrimitives(PrimitiveArrays* arrays) {
+	arrays->normal_triangles.push_back(record);
+	arrays->normals.push_back(TriangleNormals{{n1, n2, n3}});
+	arrays->normal_triangle_materials.push_back(arrays->MaterialIndex(material));
+	arrays->normal_triangle_corners.insert(arrays->normal_triangle_corners.end(), {v1, v2, v3});
+}
+
+void Mesh::AppendPrimitives(PrimitiveArrays* arrays) {
+	uint16_t material_i = arrays->MaterialIndex(material);
+	for (int i = 0; i < TriangleCount(); i++) {
+		if (smooth) {
+			arrays->normal_triangles.push_back(records[i]);
+			arrays->normals.push_back(TriangleNormals{{Normal(i, 0), Normal(i, 1), Normal(i, 2)}});
+			arrays->normal_triangle_materials.push_back(material_i);
+			arrays->normal_triangle_corners.insert(arrays->normal_triangle_corners.end(), {Vertex(i, 0), Vertex(i, 1), Vertex(i, 2)});
+		} else {
+			arrays->triangles.push_back(records[i]);
+			arrays->triangle_materials.push_back(material_i);
+			arrays->triangle_corners.insert(arrays->triangle_corners.end(), {Vertex(i, 0), Vertex(i, 1), Vertex(i, 2)});
+		}
+	}
+}
+
+// Orders spheres [first, first + count) so that every SIMD_WIDTH in a row are close together: splits at the
+// median of the longest axis, moved to a whole number of blocks, until a range fits in one block.
+static void GroupSpheres(vector<SphereRecord>& spheres, int first, int count) {
+	if (count <= SIMD_WIDTH)
+		return;
+	BoundingBox bounds = BoundingBox::Empty();
+	for (int i = first; i < first + count; i++) {
+		bounds.Extend(BoundingBox{spheres[i].position, spheres[i].position});
+	}
+	vec3 extent = bounds.max - bounds.min;
+	int axis = 0;
+	if (extent.y > extent[axis]) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+
+	int half = (count / 2 + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+	nth_element(spheres.begin() + first, spheres.begin() + first + half, spheres.begin() + first + count,
+				[axis](const SphereRecord& a, const SphereRecord& b) { return a.position[axis] < b.position[axis]; });
+	GroupSpheres(spheres, first, half);
+	GroupSpheres(spheres, first + half, count - half);
+}
+
+void SphereCloud::AppendPrimitives(PrimitiveArrays* arrays) {
+	vector<SphereRecord> spheres(SphereCount());
+	for (int i = 0; i < SphereCount(); i++) {
+		spheres[i] = SphereRecord{centers[i], radii[i]};
+	}
+	GroupSpheres(spheres, 0, spheres.size());
+
+	uint16_t material_i = arrays->MaterialIndex(material);
+	for (int i = 0; i < SphereCount(); i += SIMD_WIDTH) {
+		arrays->AddSphereBlock(&spheres[i], min(SIMD_WIDTH, SphereCount() - i), material_i);
+	}
+}
+
+
+BoundingBox BoundingBox::Empty() {
+	return BoundingBox{vec3(INFINITY, INFINITY, INFINITY), vec3(-INFINITY, -INFINITY, -INFINITY)};
+}
+
+void BoundingBox::Extend(const BoundingBox& other) {
+	min = vec3(fmin(min.x, other.min.x), fmin(min.y, other.min.y), fmin(min.z, other.min.z));
+	max = vec3(fmax(max.x, other.max.x), fmax(max.y, other.max.y), fmax(max.z, other.max.z));
+}
+
+vec3 BoundingBox::Centroid() const {
+	return (min + max) * 0.5;
+}
+
+float BoundingBox::SurfaceArea() const {
+	vec3 extent = max - min;
+	if (extent.x < 0 || extent.y < 0 || extent.z < 0) return 0;
+	return 2.0 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+bool BoundingBox::Intersect(const vec3& pos, const vec3& inv_dir, float t_max, float* t_near) const {
+	float tx1 = (min.x - pos.x) * inv_dir.x, tx2 = (max.x - pos.x) * inv_dir.x;
+	float t_enter = fmin(tx1, tx2), t_exit = fmax(tx1, tx2);
+	float ty1 = (min.y - pos.y) * inv_dir.y, ty2 = (max.y - pos.y) * inv_dir.y;
+	t_enter = fmax(t_enter, fmin(ty1, ty2));
+	t_exit = fmin(t_exit, fmax(ty1, ty2));
+	float tz1 = (min.z - pos.z) * inv_dir.z, tz2 = (max.z - pos.z) * inv_dir.z;
+	t_enter = fmax(t_enter, fmin(tz1, tz2));
+	t_exit = fmin(t_exit, fmax(tz1, tz2));
+
+	if (t_exit < t_enter || t_exit < 0 || t_enter > t_max) return false;
+	*t_near = t_enter;
+	return true;
+}
 
 
 BoundingBox Sphere::GetBoundingBox() {
+    return SphereRecord{position, radius}.Bounds();
+}
+
+BoundingBox SphereRecord::Bounds() const {
     BoundingBox bb;
     bb.min = position - vec3(radius, radius, radius);
     bb.max = position + vec3(radius, radius, radius);
     return bb;
 }
 
-BoundingBox Triangle::GetBoundingBox() {
+BoundingBox TriangleBounds(const vec3& v1, const vec3& v2, const vec3& v3) {
 	BoundingBox bb{v1, v1};
-	for (int i = 0; i < 3; i++) {
-		bb.min[i] = fmin(bb.min[i], fmin(v2[i], v3[i]));
-		bb.max[i] = fmax(bb.max[i], fmax(v2[i], v3[i]));
+	bb.Extend(BoundingBox{v2, v2});
+	bb.Extend(BoundingBox{v3, v3});
+	return bb;
+}
+
+BoundingBox Triangle::GetBoundingBox() {
+	return TriangleBounds(v1, v2, v3);
+}
+
+BoundingBox Mesh::PrimitiveBounds(int prim) {
+	return TriangleBounds(Vertex(prim, 0), Vertex(prim, 1), Vertex(prim, 2));
+}
+
+BoundingBox Mesh::GetBoundingBox() {
+	BoundingBox bb = BoundingBox::Empty();
+	for (int i = 0; i < TriangleCount(); i++) {
+		bb.Extend(PrimitiveBounds(i));
+	}
+	return bb;
+}
+
+BoundingBox SphereCloud::GetBoundingBox() {
+	BoundingBox bb = BoundingBox::Empty();
+	for (int i = 0; i < SphereCount(); i++) {
+		bb.Extend(SphereRecord{centers[i], radii[i]}.Bounds());
 	}
 	return bb;
 }
 
 
 bool Sphere::OverlapsCube(vec3 pos, float hwidth) {
+    return SphereRecord{position, radius}.OverlapsCube(pos, hwidth);
+}
+
+bool SphereRecord::OverlapsCube(vec3 pos, float hwidth) const {
     float d = 0;
     for (int i = 0; i < 3; i++) {
         float min = pos[i] - hwidth;
@@ -137,17 +350,51 @@ bool Sphere::OverlapsCube(vec3 pos, float hwidth) {
     return d < radius * radius;
 }
 
-// OPTIMIZATION: This is not correct.
+// Separating axis test from Akenine-Moller, "Fast 3D Triangle-Box Overlap Testing".
+// https://fileadmin.cs.lth.se/cs/Personal/Tomas_Akenine-Moller/code/tribox3.txt
+bool TriangleOverlapsCube(const vec3& v1, const vec3& v2, const vec3& v3, vec3 pos, float hwidth) {
+	vec3 a = v1 - pos, b = v2 - pos, c = v3 - pos;
+
+	// Box face normals, the same as overlapping the triangle's bounding box.
+	if (fmin(a.x, fmin(b.x, c.x)) > hwidth || fmax(a.x, fmax(b.x, c.x)) < -hwidth) return false;
+	if (fmin(a.y, fmin(b.y, c.y)) > hwidth || fmax(a.y, fmax(b.y, c.y)) < -hwidth) return false;
+	if (fmin(a.z, fmin(b.z, c.z)) > hwidth || fmax(a.z, fmax(b.z, c.z)) < -hwidth) return false;
+
+	// Triangle plane.
+	vec3 edges[3] = {b - a, c - b, a - c};
+	vec3 norm = cross(edges[0], edges[1]);
+	if (fabs(dot(norm, a)) > hwidth * (fabs(norm.x) + fabs(norm.y) + fabs(norm.z))) return false;
+
+	// Each triangle edge crossed with each box axis.
+	for (vec3 e : edges) {
+		vec3 axes[3] = {vec3(0, -e.z, e.y), vec3(e.z, 0, -e.x), vec3(-e.y, e.x, 0)};
+		for (vec3 axis : axes) {
+			float p0 = dot(a, axis), p1 = dot(b, axis), p2 = dot(c, axis);
+			float r = hwidth * (fabs(axis.x) + fabs(axis.y) + fabs(axis.z));
+			if (fmin(p0, fmin(p1, p2)) > r || fmax(p0, fmax(p1, p2)) < -r) return false;
+		}
+	}
+	return true;
+}
+
+bool Geometry::Occluded(Ray ray, float t_max) {
+	HitInformation hit;
+	return FindIntersection(ray, &hit) && hit.dist < t_max;
+}
+
 bool Triangle::OverlapsCube(vec3 pos, float hwidth) {
-	// This could be implemented, but it's written by a person who cannot code for their life.
-    // https://fileadmin.cs.lth.se/cs/Personal/Tomas_Akenine-Moller/code/tribox3.txt
+	return TriangleOverlapsCube(v1, v2, v3, pos, hwidth);
+}
+
+// Fallback for shapes without an exact test: bounding box against the cube.
+bool Geometry::OverlapsCube(vec3 pos, float hwidth) {
 	BoundingBox bb = GetBoundingBox();
 	vec3 other_min = pos - vec3(hwidth, hwidth, hwidth);
 	vec3 other_max = pos + vec3(hwidth, hwidth, hwidth);
-	bool x_overlaps = (bb.max.x > other_min.x && bb.min.x < other_max.x);
-	bool y_overlaps = (bb.max.y > other_min.y && bb.min.y < other_max.y);
-	bool z_overlaps = (bb.max.z > other_min.z && bb.min.z < other_max.z);
+	bool x_overlaps = (bb.max.x >= other_min.x && bb.min.x <= other_max.x);
+	bool y_overlaps = (bb.max.y >= other_min.y && bb.min.y <= other_max.y);
+	bool z_overlaps = (bb.max.z >= other_min.z && bb.min.z <= other_max.z);
 	return x_overlaps && y_overlaps && z_overlaps;
 }
 
-}  // namespace Raytracer
\ No newline at end of file
+}  // namespace Raytracer
\ No newline at end of file
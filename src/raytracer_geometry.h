@@ -4,6 +4,8 @@
 #define RAY_EPSILON 0.01
 
 #include <vector>
+#include <memory>
+#include <stdint.h>
 #include <iostream>
 #include "raytracer_ray.h"
 #include "raytracer_object.h"
@@ -16,21 +18,70 @@ namespace Raytracer {
 struct BoundingBox {
 	vec3 min = vec3(0,0,0);
 	vec3 max = vec3(0,0,0);
+
+	// Inverted box that any Extend will overwrite.
+	static BoundingBox Empty();
+	void Extend(const BoundingBox& other);
+	vec3 Centroid() const;
+	float SurfaceArea() const;
+	// Slab test against a ray given its reciprocal direction. Writes the entry distance on a hit.
+	bool Intersect(const vec3& pos, const vec3& inv_dir, float t_max, float* t_near) const;
+};
+
+// Sphere data for the intersection loops.
+struct SphereRecord {
+	vec3 position;
+	float radius;
+
+	// On a hit writes the distance to the nearest intersection in front of the ray.
+	bool Intersect(const Ray& ray, float* t) const;
+	BoundingBox Bounds() const;
+	// pos is the center of the cube, hwidth half of its side length.
+	bool OverlapsCube(vec3 pos, float hwidth) const;
 };
 
+// Triangle data precomputed in PreRender() for the Moller-Trumbore test.
+struct TriangleRecord {
+	vec3 v1, edge1, edge2;
+	// Unit normal for flat shading, following the CCW winding.
+	vec3 normal;
+
+	TriangleRecord() {}
+	TriangleRecord(const vec3& a, const vec3& b, const vec3& c);
+	// On a hit writes t and the barycentric weights u, v of the 2nd and 3rd vertex.
+	bool Intersect(const Ray& ray, float* t, float* u, float* v) const;
+};
+
+BoundingBox TriangleBounds(const vec3& v1, const vec3& v2, const vec3& v3);
+bool TriangleOverlapsCube(const vec3& v1, const vec3& v2, const vec3& v3, vec3 pos, float hwidth);
+
+struct PrimitiveArrays;
+
 struct Geometry : Object {
     Material* material;
 
     Geometry(int* entity_count, Material* mat);
     Geometry(int old_id, Material* mat);
 
+#ifndef RAYTRACER_HEADLESS
     void ImGui();
-    string Encode();
-    void Decode(string& s);
+    void MaterialImGui();
+#endif
+    void Encode(SceneWriter& out);
+    void Decode(FieldReader& in);
+	// Copy for a render snapshot, still pointing at the same material.
+	virtual Geometry* Clone() const { return new Geometry(*this); }
 
     virtual bool FindIntersection(Ray ray, HitInformation* intersection) { return false; }
-	virtual bool OverlapsCube(vec3 pos, float hwidth) { return false; }
+	// Any hit closer than t_max. Shadow rays only need this, so shapes can skip building HitInformation.
+	virtual bool Occluded(Ray ray, float t_max);
+	// pos is the center of the cube, hwidth half of its side length.
+	virtual bool OverlapsCube(vec3 pos, float hwidth);
 	virtual BoundingBox GetBoundingBox() { return BoundingBox(); }
+
+	// Adds the shape's primitives to the arrays renders trace against, see raytracer_primitives.h.
+	// Called after PreRender(). Shapes that add nothing are never hit.
+	virtual void AppendPrimitives(PrimitiveArrays* arrays) {}
 };
 
 struct Sphere : Geometry {
@@ -39,27 +90,40 @@ struct Sphere : Geometry {
 
     using Geometry::Geometry;
 
+#ifndef RAYTRACER_HEADLESS
     void ImGui();
-    string Encode();
-    void Decode(string& s);
+#endif
+    void Encode(SceneWriter& out);
+    void Decode(FieldReader& in);
+	Geometry* Clone() const { return new Sphere(*this); }
 
+    bool Intersect(const Ray& ray, float* t);
     bool FindIntersection(Ray ray, HitInformation* intersection);
+	bool Occluded(Ray ray, float t_max);
 	bool OverlapsCube(vec3 pos, float hwidth);
 	BoundingBox GetBoundingBox();
+	void AppendPrimitives(PrimitiveArrays* arrays);
 };
 
 struct Triangle : Geometry {
     vec3 v1 = vec3(), v2 = vec3(), v3 = vec3();
+    TriangleRecord record;
 
     using Geometry::Geometry;
 
+#ifndef RAYTRACER_HEADLESS
     virtual void ImGui();
-    virtual string Encode();
-    virtual void Decode(string& s);
+#endif
+    virtual void Encode(SceneWriter& out);
+    virtual void Decode(FieldReader& in);
+	virtual void PreRender();
+	virtual Geometry* Clone() const { return new Triangle(*this); }
 
     virtual bool FindIntersection(Ray ray, HitInformation* intersection);
+	virtual bool Occluded(Ray ray, float t_max);
 	bool OverlapsCube(vec3 pos, float hwidth);
 	BoundingBox GetBoundingBox();
+	virtual void AppendPrimitives(PrimitiveArrays* arrays);
 };
 
 struct NormalTriangle : Triangle  {
@@ -67,15 +131,80 @@ struct NormalTriangle : Triangle  {
     
     using Triangle::Triangle;
 
+#ifndef RAYTRACER_HEADLESS
     void ImGui();
-    string Encode();
-    void Decode(string& s);
+#endif
+    void Encode(SceneWriter& out);
+    void Decode(FieldReader& in);
 	void PreRender();
+	Geometry* Clone() const { return new NormalTriangle(*this); }
 
     bool FindIntersection(Ray ray, HitInformation* intersection);
+	void AppendPrimitives(PrimitiveArrays* arrays);
+};
 
+// Triangles indexing into vertex and normal buffers, built from a scene file's vertex: and normal: lines.
+// Replaces one Triangle or NormalTriangle object per triangle.
+struct Mesh : Geometry {
+	// The whole file's buffers, shared by every mesh loaded from it.
+	shared_ptr<const vector<vec3>> positions;
+	shared_ptr<const vector<vec3>> normals;
+	// Three entries per triangle. normal_indices stays empty unless the mesh is smooth.
+	vector<uint32_t> vertex_indices;
+	vector<uint32_t> normal_indices;
+	bool smooth = false;
+	vector<TriangleRecord> records;
+
+	using Geometry::Geometry;
+
+#ifndef RAYTRACER_HEADLESS
+	void ImGui();
+#endif
+	void Encode(SceneWriter& out);
+	// Appends a triangle from the rest of a triangle: or normal_triangle: line.
+	void Decode(FieldReader& in);
+	void PreRender();
+	// Shares the vertex and normal buffers.
+	Geometry* Clone() const { return new Mesh(*this); }
+
+	int TriangleCount() const { return vertex_indices.size() / 3; }
+	const vec3& Vertex(int tri, int corner) const { return (*positions)[vertex_indices[3 * tri + corner]]; }
+	const vec3& Normal(int tri, int corner) const { return (*normals)[normal_indices[3 * tri + corner]]; }
+
+	bool FindIntersection(Ray ray, HitInformation* intersection);
+	bool Occluded(Ray ray, float t_max);
+	BoundingBox GetBoundingBox();
+
+	BoundingBox PrimitiveBounds(int prim);
+	bool IntersectPrimitive(int prim, const Ray& ray, HitInformation* intersection);
+	bool OccludedPrimitive(int prim, const Ray& ray, float t_max);
+	// One flat or smooth triangle per mesh triangle.
+	void AppendPrimitives(PrimitiveArrays* arrays);
+};
+
+// Spheres sharing one material, built from runs of sphere: lines and from sphere_cloud: lines. Replaces one
+// Sphere object per sphere, and renders as sphere blocks that test SIMD_WIDTH spheres at once.
+struct SphereCloud : Geometry {
+	vector<vec3> centers;
+	vector<float> radii;
+
+	using Geometry::Geometry;
+
+#ifndef RAYTRACER_HEADLESS
+	void ImGui();
+#endif
+	// Written as sphere: lines, which load back into a cloud.
+	void Encode(SceneWriter& out);
+	// Appends every sphere on the rest of a sphere: or sphere_cloud: line.
+	void Decode(FieldReader& in);
+	Geometry* Clone() const { return new SphereCloud(*this); }
+
+	int SphereCount() const { return centers.size(); }
+	BoundingBox GetBoundingBox();
+	// Groups neighboring spheres into blocks of SIMD_WIDTH.
+	void AppendPrimitives(PrimitiveArrays* arrays);
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -1,80 +1,188 @@
 // Author: Cole Johnson, 3/16/2021
 // Uses details from http://www.cse.chalmers.se/edu/year/2012/course/_courses_2011/TDA361/grid.pdf
+// Traversal is Amanatides and Woo, "A Fast Voxel Traversal Algorithm for Ray Tracing" (1987).
 
 #include "raytracer_grid.h"
 
+#include <algorithm>
 
 namespace Raytracer { 
 
-// TODO: If there is an intersection, check to make sure it's in the current voxel.
-// Otherwise, check non-mailboxed shapes in the next voxel. Stop when our marked intersection
-// is on our current voxel.
-
-void Grid::AddGeometry(Geometry* geo) {
-	BoundingBox bb = geo->GetBoundingBox();
-	for (int x = (int) bb.min.x; x < ceilf(bb.max.x); x++) {
-		for (int y = (int) bb.min.y; y < ceilf(bb.max.y); y++) {
-			for (int z = (int) bb.min.z; z < ceilf(bb.max.z); z++) {
-				bb_min = imin(bb_min, vec3i(x,y,z));
-				bb_max = imax(bb_max, vec3i(x,y,z));
-				if (geo->OverlapsCube(vec3(size*x,size*y,size*z), size)) {
-					vec3i key = vec3i(x,y,z);
-					if (objects.count(key) == 0) {
-						pair<vec3i, vector<Geometry*>> to_insert(key, {geo});
-						objects.insert(to_insert);
-					} else {
-						objects.at(key).push_back(geo);
-					}
-				} 
+// Mailbox: the id of the last ray that tested each primitive, so primitives spanning several cells are
+// only intersected once per ray. Kept per thread since render threads share the grid.
+thread_local vector<unsigned int> mailbox;
+thread_local unsigned int mailbox_ray = 0;
+
+vec3 Grid::CellCenter(int x, int y, int z) const {
+	return origin + vec3((x + 0.5) * size, (y + 0.5) * size, (z + 0.5) * size);
+}
+
+void Grid::Build(const PrimitiveArrays& arrays) {
+	prims = &arrays;
+	cell_items.clear();
+
+	int prim_count = arrays.Count();
+	vector<BoundingBox> prim_bounds;
+	bounds = BoundingBox::Empty();
+	for (int i = 0; i < prim_count; i++) {
+		prim_bounds.push_back(arrays.Bounds(i));
+		bounds.Extend(prim_bounds.back());
+	}
+	if (prim_count == 0) {
+		res = vec3i(0, 0, 0);
+		cell_start.assign(1, 0);
+		return;
+	}
+
+	// Pick a cube size giving roughly GRID_DENSITY primitives per cell (Cleary and Wyvill), then
+	// grow it if any axis would need more than GRID_MAX_RES cells.
+	vec3 extent = bounds.max - bounds.min;
+	double min_extent = 1e-4 * fmax(extent.x, fmax(extent.y, fmax(extent.z, 1e-4)));
+	double volume = fmax(extent.x, min_extent) * fmax(extent.y, min_extent) * fmax(extent.z, min_extent);
+	size = cbrt(volume / (GRID_DENSITY * prim_count));
+	size = fmax(size, fmax(extent.x, fmax(extent.y, extent.z)) / GRID_MAX_RES);
+	res.x = max(1, (int)ceil(extent.x / size));
+	res.y = max(1, (int)ceil(extent.y / size));
+	res.z = max(1, (int)ceil(extent.z / size));
+	origin = bounds.min;
+
+	// Slightly inflated so primitives lying exactly on a cell face land in both neighbours.
+	float hwidth = size * 0.5 * (1 + 1e-4);
+	auto for_each_cell = [&](int prim_i, auto visit) {
+		BoundingBox& bb = prim_bounds[prim_i];
+		int lo_x = clamp((int)floor((bb.min.x - origin.x) / size), 0, res.x - 1);
+		int lo_y = clamp((int)floor((bb.min.y - origin.y) / size), 0, res.y - 1);
+		int lo_z = clamp((int)floor((bb.min.z - origin.z) / size), 0, res.z - 1);
+		int hi_x = clamp((int)floor((bb.max.x - origin.x) / size), 0, res.x - 1);
+		int hi_y = clamp((int)floor((bb.max.y - origin.y) / size), 0, res.y - 1);
+		int hi_z = clamp((int)floor((bb.max.z - origin.z) / size), 0, res.z - 1);
+		for (int z = lo_z; z <= hi_z; z++) {
+			for (int y = lo_y; y <= hi_y; y++) {
+				for (int x = lo_x; x <= hi_x; x++) {
+					if (arrays.OverlapsCube(prim_i, CellCenter(x, y, z), hwidth))
+						visit(CellIndex(x, y, z));
+				}
 			}
 		}
+	};
+
+	// Count, prefix sum, then fill, so every cell is a contiguous slice of cell_items.
+	int cell_count = res.x * res.y * res.z;
+	cell_start.assign(cell_count + 1, 0);
+	for (int i = 0; i < prim_count; i++) {
+		for_each_cell(i, [&](int cell) { cell_start[cell + 1]++; });
+	}
+	for (int cell = 0; cell < cell_count; cell++) {
+		cell_start[cell + 1] += cell_start[cell];
+	}
+	cell_items.resize(cell_start[cell_count]);
+	vector<int> cursor(cell_start.begin(), cell_start.end() - 1);
+	for (int i = 0; i < prim_count; i++) {
+		for_each_cell(i, [&](int cell) { cell_items[cursor[cell]++] = i; });
 	}
 }
 
-// TODO: cull bounding box
-void Grid::RemoveGeometry(Geometry* geo) {
-	for (auto const& kvp : objects) {
-		value.erase(remove(value.begin(), value.end(), geo));
+// Steps through the cells along the ray in order, calling visit(cell, t_exit) for each one until it
+// returns true, the ray leaves the grid or passes t_max.
+template <class Visit>
+bool Grid::Walk(const Ray& ray, float t_max, Visit visit) {
+	if (cell_items.empty())
+		return false;
+
+	vec3 inv_dir = vec3(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+	float t_enter;
+	if (!bounds.Intersect(ray.pos, inv_dir, t_max, &t_enter))
+		return false;
+	t_enter = fmax(t_enter, 0);
+
+	if (mailbox.size() < prims->Count())
+		mailbox.resize(prims->Count(), 0);
+	if (++mailbox_ray == 0) {
+		fill(mailbox.begin(), mailbox.end(), 0);
+		mailbox_ray = 1;
+	}
+
+	// Per axis: current cell, step direction, distance to the next cell boundary and between boundaries.
+	double pos[3] = {ray.pos.x, ray.pos.y, ray.pos.z};
+	double dir[3] = {ray.dir.x, ray.dir.y, ray.dir.z};
+	double grid_origin[3] = {origin.x, origin.y, origin.z};
+	int grid_res[3] = {res.x, res.y, res.z};
+	int cell[3], step[3];
+	double t_next[3], t_delta[3];
+	for (int axis = 0; axis < 3; axis++) {
+		double entry = pos[axis] + dir[axis] * t_enter;
+		cell[axis] = clamp((int)floor((entry - grid_origin[axis]) / size), 0, grid_res[axis] - 1);
+		if (dir[axis] > 0) {
+			step[axis] = 1;
+			t_next[axis] = (grid_origin[axis] + (cell[axis] + 1) * size - pos[axis]) / dir[axis];
+			t_delta[axis] = size / dir[axis];
+		} else if (dir[axis] < 0) {
+			step[axis] = -1;
+			t_next[axis] = (grid_origin[axis] + cell[axis] * size - pos[axis]) / dir[axis];
+			t_delta[axis] = -size / dir[axis];
+		} else {
+			step[axis] = 0;
+			t_next[axis] = INFINITY;
+			t_delta[axis] = INFINITY;
+		}
+	}
+
+	while (true) {
+		int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+		if (visit(CellIndex(cell[0], cell[1], cell[2]), t_next[axis]))
+			return true;
+
+		if (t_next[axis] > t_max)
+			return false;
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= grid_res[axis])
+			return false;
+		t_next[axis] += t_delta[axis];
 	}
 }
 
-void Grid::MoveGeometry(Geometry* geo) {
-	RemoveGeometry(geo);
-	AddGeometry(geo);
+bool Grid::FindIntersection(const Ray& ray, HitInformation* intersection) {
+	PrimitiveHit current_hit, best_hit;
+	float closest = INFINITY;
+	bool hit = false;
+	Walk(ray, INFINITY, [&](int cell_i, double t_exit) {
+		for (int i = cell_start[cell_i]; i < cell_start[cell_i + 1]; i++) {
+			int prim = cell_items[i];
+			if (mailbox[prim] == mailbox_ray)
+				continue;
+			mailbox[prim] = mailbox_ray;
+			if (prims->Intersect(prim, ray, &current_hit) &&
+				current_hit.t < closest) {
+				best_hit = current_hit;
+				closest = current_hit.t;
+				hit = true;
+			}
+		}
+		// A hit found in an earlier cell may lie further along; it only counts once we've reached it.
+		return closest <= t_exit;
+	});
+	if (hit)
+		prims->Resolve(ray, best_hit, intersection);
+	return hit;
 }
 
-void Grid::InitializeIter(vec3 p, vec3 d) {
-	pos = p;
-	dir = d;
-	// TODO: min(dir) should be 1, not 0.7-1
-	dir_sign.x = d.x < 0 ? -1 : 1;
-	dir_sign.y = d.y < 0 ? -1 : 1;
-	dir_sign.z = d.z < 0 ? -1 : 1;
+bool Grid::Occluded(const Ray& ray, float t_max) {
+	return Walk(ray, t_max, [&](int cell_i, double t_exit) {
+		for (int i = cell_start[cell_i]; i < cell_start[cell_i + 1]; i++) {
+			int prim = cell_items[i];
+			if (mailbox[prim] == mailbox_ray)
+				continue;
+			mailbox[prim] = mailbox_ray;
+			if (prims->Occluded(prim, ray, t_max))
+				return true;
+		}
+		return false;
+	});
 }
 
-bool Grid::GetNext(vector<Geometry*>& out) {
-	// TODO: There is a lot of recalculation here. Save more state.
-	// next doesn't change if t does not belong to the axis, but maybe the if statement isnt' worth it.
-	// also, coordinate can't be out of bounds in same condition
-	if (pos.x < bb_min.x || pos.x > bb_max.x) return false;
-	if (pos.y < bb_min.y || pos.y > bb_max.y) return false;
-	if (pos.z < bb_min.z || pos.z > bb_max.z) return false;
-
-	vec3i posi = vec3i((int) pos.x, (int) pos.y, (int) pos.z);
-	if (objects.count(posi) == 1)
-		out = objects.at(posi);
-	else 
-		out.clear();
-
-	vec3i next;
-	next.x = (int) (pos.x + dir_sign.x);
-	next.y = (int) (pos.y + dir_sign.y);
-	next.z = (int) (pos.z + dir_sign.z);
-
-	float t = fmin(next.x - pos.x, fmin(next.y - pos.y, next.z - pos.z));
-
-	pos = t*dir;
-	return true;
+string Grid::Stats() {
+	return "Grid: " + to_string(res.x) + "x" + to_string(res.y) + "x" + to_string(res.z) + " cells, " +
+		to_string(cell_items.size()) + " references to " + to_string(prims->Count()) + " primitives";
 }
 
-}  // namespace Raytracer
\ No newline at end of file
+}  // namespace Raytracer
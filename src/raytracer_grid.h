@@ -1,48 +1,44 @@
 #ifndef _RAYTRACER_GRID_H
 #define _RAYTRACER_GRID_H
 
-#include <unordered_map>
 #include <vector>
 #include <vec3.h>
 #include <math.h>
 
-#include "raytracer_geometry.h"
+#include "raytracer_accelerator.h"
 
-namespace Raytracer {
+// Target number of primitives per cell when picking the resolution.
+#define GRID_DENSITY 3.0
+#define GRID_MAX_RES 256
 
-struct Geometry;
+namespace Raytracer {
 
 using namespace std;
 
+// Uniform grid of cubic cells. Cell contents are stored CSR style: the primitives overlapping
+// cell i are cell_items[cell_start[i]] up to cell_items[cell_start[i + 1]].
+struct Grid : Accelerator {
+	float size = 1.0;
+	vec3 origin;
+	vec3i res;
+	BoundingBox bounds;
 
-#define BASE 16
-auto hash = [](const vec3i& v) {
-	return v.x * (BASE * BASE) + v.y * BASE + v.z;
-};
-auto equal = [](const vec3i& a, const vec3i& b) {
-	return a.x == b.x && a.y == b.y && a.z == b.z;
-};
-
-struct Grid {
-	float size;
-	unordered_map<vec3i, vector<Geometry*>, decltype(hash), decltype(equal)> objects(8, hash, equal);
-	vec3i bb_min;
-	vec3i bb_max;
-
-	vec3 pos;
-	vec3 dir;
-	vec3 dir_sign;
+	vector<int> cell_start;
+	vector<int> cell_items;
 
-	Grid(float s) : size(s) {}
+	void Build(const PrimitiveArrays& arrays);
+	bool FindIntersection(const Ray& ray, HitInformation* intersection);
+	bool Occluded(const Ray& ray, float t_max);
+	string Stats();
 
-	void AddGeometry(Geometry* geo);
-	void RemoveGeometry(Geometry* geo);
-	void MoveGeometry(Geometry* geo);
+	int CellIndex(int x, int y, int z) const { return x + res.x * (y + res.y * z); }
+	vec3 CellCenter(int x, int y, int z) const;
 
-	void InitializeIter(vec3 p, vec3 d);
-	bool GetNext(vector<Geometry*>& out);
+  private:
+	template <class Visit>
+	bool Walk(const Ray& ray, float t_max, Visit visit);
 };
 
 }  // namespace Raytracer
 
-#endif
\ No newline at end of file
+#endif
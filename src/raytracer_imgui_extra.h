@@ -2,14 +2,18 @@
 #define _RAYTRACER_IMGUI_EXTRA_H
 
 #include "imgui.h"
+#include <vec3.h>
 
 namespace ImGui {
 
-inline bool DragDoubleN(const char* label, void* p_data, int components, float v_speed = 0.1, 
-	const double p_min = 0.0, const double p_max = 0.0, const char* format = "%.2f", ImGuiSliderFlags flags = 0) {
-	return ImGui::DragScalarN(label, ImGuiDataType_Double, p_data, components, v_speed, &p_min, &p_max, format, flags);
+// Drags all three components in whichever precision vec3 was built with.
+template <typename T>
+inline bool DragVec3(const char* label, vec3t<T>* v, float v_speed = 0.1,
+	const typename vec3t<T>::scalar p_min = 0.0, const typename vec3t<T>::scalar p_max = 0.0, const char* format = "%.2f", ImGuiSliderFlags flags = 0) {
+	ImGuiDataType type = sizeof(T) == sizeof(double) ? ImGuiDataType_Double : ImGuiDataType_Float;
+	return ImGui::DragScalarN(label, type, &v->x, 3, v_speed, &p_min, &p_max, format, flags);
 }
 
 }
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
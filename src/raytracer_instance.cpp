@@ -0,0 +1,245 @@
+#include "raytracer_instance.h"
+
+#include <unordered_map>
+#include "raytracer_render.h"
+
+namespace Raytracer {
+
+// Most instances in a top level leaf.
+#define INSTANCE_MAX_LEAF 2
+#define INSTANCE_STACK_SIZE 64
+
+Prototype::~Prototype() {
+    for (Geometry* geo : shapes) delete geo;
+    for (Material* mat : materials) delete mat;
+}
+
+void Prototype::Finish() {
+    unordered_map<const Material*, Material*> copies;
+    for (Geometry* geo : shapes) {
+        Material*& copy = copies[geo->material];
+        if (copy == NULL) {
+            copy = new Material(*geo->material);
+            materials.push_back(copy);
+        }
+        geo->material = copy;
+    }
+}
+
+// Compiled on first use rather than in Finish(), as meshes only get their vertices once the whole file is read.
+void Prototype::Compile() {
+    if (compiled)
+        return;
+    for (Geometry* geo : shapes) {
+        geo->PreRender();
+        geo->AppendPrimitives(&primitives);
+    }
+    primitives.Finish();
+    bounds = BoundingBox::Empty();
+    for (uint32_t prim = 0; prim < primitives.Count(); prim++) {
+        bounds.Extend(primitives.Bounds(prim));
+    }
+    compiled = true;
+}
+
+const BoundingBox& Prototype::Bounds() {
+    lock_guard<mutex> guard(build_lock);
+    Compile();
+    return bounds;
+}
+
+Accelerator* Prototype::BottomLevel(int type) {
+    lock_guard<mutex> guard(build_lock);
+    Compile();
+    unique_ptr<Accelerator>& accelerator = accelerators[type];
+    if (!accelerator) {
+        accelerator.reset(NewAccelerator(type));
+        steady_clock::time_point build_start = steady_clock::now();
+        accelerator->Build(primitives);
+        accelerator->build_ms = duration<float, milli>(steady_clock::now() - build_start).count();
+        Log("object " + name + ": " + accelerator->Stats() + ", built in " + to_string(accelerator->build_ms) + "ms");
+    }
+    return accelerator.get();
+}
+
+// Rows of Rz * Ry * Rx, which turns about x first.
+static void RotationRows(const vec3& degrees, vec3 rows[3]) {
+    double a = degrees.x * (M_PI / 180), b = degrees.y * (M_PI / 180), c = degrees.z * (M_PI / 180);
+    double ca = cos(a), sa = sin(a), cb = cos(b), sb = sin(b), cc = cos(c), sc = sin(c);
+    rows[0] = vec3(cc * cb, cc * sb * sa - sc * ca, cc * sb * ca + sc * sa);
+    rows[1] = vec3(sc * cb, sc * sb * sa + cc * ca, sc * sb * ca - cc * sa);
+    rows[2] = vec3(-sb, cb * sa, cb * ca);
+}
+
+static vec3 Rotate(const vec3 rows[3], const vec3& v) {
+    return vec3(dot(rows[0], v), dot(rows[1], v), dot(rows[2], v));
+}
+
+static vec3 RotateBack(const vec3 rows[3], const vec3& v) {
+    return rows[0] * v.x + rows[1] * v.y + rows[2] * v.z;
+}
+
+Ray InstanceRecord::ToObject(const Ray& ray) const {
+    vec3 start = ray.pos + ray.dir * shift;
+    Ray local(RotateBack(rotation, start - position) * (1 / scale), RotateBack(rotation, ray.dir), ray.bounces_left);
+    local.last_material = ray.last_material;
+    return local;
+}
+
+void InstanceTree::Build(const vector<Instance*>& scene_instances, int accelerator_type) {
+    instances.clear();
+    nodes.clear();
+    for (Instance* instance : scene_instances) {
+        const BoundingBox& local = instance->prototype->Bounds();
+        // Nothing to hit.
+        if (local.min.x > local.max.x)
+            continue;
+
+        InstanceRecord record;
+        record.bottom_level = instance->prototype->BottomLevel(accelerator_type);
+        record.position = instance->position;
+        RotationRows(instance->rotation, record.rotation);
+        record.scale = instance->scale;
+        record.shift = RAY_EPSILON * (1 - record.scale);
+        record.bounds = BoundingBox::Empty();
+        for (int corner = 0; corner < 8; corner++) {
+            vec3 p((corner & 1) ? local.max.x : local.min.x, (corner & 2) ? local.max.y : local.min.y,
+                   (corner & 4) ? local.max.z : local.min.z);
+            vec3 world = record.position + Rotate(record.rotation, p) * record.scale;
+            record.bounds.Extend(BoundingBox{world, world});
+        }
+        instances.push_back(record);
+    }
+
+    if (!instances.empty()) {
+        nodes.reserve(2 * instances.size());
+        nodes.push_back(InstanceNode{});
+        Subdivide(0, 0, instances.size());
+    }
+}
+
+// Median split of the longest axis of the centroids. There are few instances, so build speed doesn't matter much,
+// but rebuilding on every render does rule out a full SAH sweep.
+void InstanceTree::Subdivide(int node_i, int first, int count) {
+    BoundingBox bounds = BoundingBox::Empty();
+    BoundingBox centroids = BoundingBox::Empty();
+    for (int i = first; i < first + count; i++) {
+        bounds.Extend(instances[i].bounds);
+        vec3 c = instances[i].bounds.Centroid();
+        centroids.Extend(BoundingBox{c, c});
+    }
+    nodes[node_i] = InstanceNode{bounds, -1, first, count};
+    if (count <= INSTANCE_MAX_LEAF)
+        return;
+
+    vec3 extent = centroids.max - centroids.min;
+    int axis = 0;
+    if (extent.y > extent[axis]) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+    int half = count / 2;
+    nth_element(instances.begin() + first, instances.begin() + first + half, instances.begin() + first + count,
+                [axis](const InstanceRecord& a, const InstanceRecord& b) {
+                    return a.bounds.Centroid()[axis] < b.bounds.Centroid()[axis];
+                });
+
+    int left = nodes.size();
+    nodes[node_i].child = left;
+    nodes.push_back(InstanceNode{});
+    nodes.push_back(InstanceNode{});
+    Subdivide(left, first, half);
+    Subdivide(left + 1, first + half, count - half);
+}
+
+bool InstanceTree::FindIntersection(const Ray& ray, float t_max, HitInformation* intersection) const {
+    if (nodes.empty())
+        return false;
+
+    vec3 inv_dir = vec3(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+    float closest = t_max;
+    float t_near;
+    if (!nodes[0].bounds.Intersect(ray.pos, inv_dir, closest, &t_near))
+        return false;
+
+    // Near child first, as in BVH::FindIntersection(), so overlapping instances behind a hit are skipped.
+    struct StackEntry {
+        int node;
+        float t_near;
+    };
+    StackEntry stack[INSTANCE_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = StackEntry{0, t_near};
+
+    HitInformation local_hit;
+    bool hit = false;
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        if (entry.t_near > closest)
+            continue;
+
+        const InstanceNode& node = nodes[entry.node];
+        if (node.child != -1) {
+            float t_left, t_right;
+            bool hit_left = nodes[node.child].bounds.Intersect(ray.pos, inv_dir, closest, &t_left);
+            bool hit_right = nodes[node.child + 1].bounds.Intersect(ray.pos, inv_dir, closest, &t_right);
+            if (hit_left && hit_right) {
+                if (t_left < t_right) {
+                    stack[stack_size++] = StackEntry{node.child + 1, t_right};
+                    stack[stack_size++] = StackEntry{node.child, t_left};
+                } else {
+                    stack[stack_size++] = StackEntry{node.child, t_left};
+                    stack[stack_size++] = StackEntry{node.child + 1, t_right};
+                }
+            } else if (hit_left) {
+                stack[stack_size++] = StackEntry{node.child, t_left};
+            } else if (hit_right) {
+                stack[stack_size++] = StackEntry{node.child + 1, t_right};
+            }
+            continue;
+        }
+
+        for (int i = node.first; i < node.first + node.count; i++) {
+            const InstanceRecord& instance = instances[i];
+            if (!instance.bottom_level->FindIntersection(instance.ToObject(ray), &local_hit))
+                continue;
+            float t = instance.ToWorld(local_hit.dist);
+            if (t < closest) {
+                vec3 normal = Rotate(instance.rotation, local_hit.normal);
+                *intersection = HitInformation{t, ray.pos + t * ray.dir, ray.dir, normal, local_hit.material};
+                closest = t;
+                hit = true;
+            }
+        }
+    }
+    return hit;
+}
+
+bool InstanceTree::Occluded(const Ray& ray, float t_max) const {
+    if (nodes.empty())
+        return false;
+
+    vec3 inv_dir = vec3(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+    int stack[INSTANCE_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    float t_near;
+    while (stack_size > 0) {
+        const InstanceNode& node = nodes[stack[--stack_size]];
+        if (!node.bounds.Intersect(ray.pos, inv_dir, t_max, &t_near))
+            continue;
+        if (node.child != -1) {
+            stack[stack_size++] = node.child + 1;
+            stack[stack_size++] = node.child;
+            continue;
+        }
+
+        for (int i = node.first; i < node.first + node.count; i++) {
+            const InstanceRecord& instance = instances[i];
+            if (instance.bottom_level->Occluded(instance.ToObject(ray), (t_max - instance.shift) / instance.scale))
+                return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace Raytracer
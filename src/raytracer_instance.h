@@ -0,0 +1,118 @@
+#ifndef _RAYTRACER_INSTANCE_H
+#define _RAYTRACER_INSTANCE_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vec3.h>
+#include "raytracer_accelerator.h"
+#include "raytracer_geometry.h"
+#include "raytracer_primitives.h"
+
+using namespace std;
+
+namespace Raytracer {
+
+// Shapes defined once between the object: and end_object: lines of a scene file and placed any number of times
+// by instance: lines. Every instance shares the prototype's primitives and bottom level accelerator, so memory
+// grows with the objects a scene defines, not with how often it places them.
+//
+// Never changed once loaded, so renders can share it with the editor and with each other.
+struct Prototype {
+    string name;
+    // Owned, like the materials they point at, which are copied out of the scene's table so a Reset() or a
+    // pruned material can't pull them out from under a render.
+    vector<Geometry*> shapes;
+    vector<Material*> materials;
+
+    Prototype(const string& name) : name(name) {}
+    Prototype(const Prototype&) = delete;
+    ~Prototype();
+
+    // Gives the shapes their own copies of their materials. Called once the object's lines have been read.
+    void Finish();
+    void Encode(SceneWriter& out);
+    // Bounds of every primitive, in the object's own space.
+    const BoundingBox& Bounds();
+    // The bottom level accelerator of the given type, built on first use and kept for every later render.
+    Accelerator* BottomLevel(int type);
+
+  private:
+    mutex build_lock;
+    bool compiled = false;
+    PrimitiveArrays primitives;
+    BoundingBox bounds;
+    unique_ptr<Accelerator> accelerators[ACCEL_COUNT];
+
+    void Compile();
+};
+
+// One placement of a prototype: a uniform scale, then rotations about x, y and z in degrees, then a translation.
+// Scaling stays uniform so normals only need the rotation and hit distances only the scale.
+struct Instance : Geometry {
+    shared_ptr<Prototype> prototype;
+    vec3 position = vec3(0, 0, 0);
+    vec3 rotation = vec3(0, 0, 0);
+    float scale = 1;
+
+    // Instances have no material of their own, their prototype's shapes bring theirs.
+    Instance(int* entity_count, shared_ptr<Prototype> prototype) : Geometry(entity_count, NULL), prototype(prototype) {}
+
+#ifndef RAYTRACER_HEADLESS
+    void ImGui();
+#endif
+    void Encode(SceneWriter& out);
+    // Reads the placement after the prototype name of an instance: line.
+    void Decode(FieldReader& in);
+    Geometry* Clone() const { return new Instance(*this); }
+};
+
+// An instance as the top level sees it, with its transform worked out.
+struct InstanceRecord {
+    Accelerator* bottom_level;
+    vec3 position;
+    // Rows of the rotation. Object to world turns vectors by it, world to object by its transpose.
+    vec3 rotation[3];
+    float scale;
+    // How far along the world ray the object ray starts. Primitives skip hits closer than RAY_EPSILON in their
+    // own units, so the start is moved to put that cutoff at RAY_EPSILON along the world ray whatever the scale.
+    float shift;
+    BoundingBox bounds;
+
+    // The ray in the object's space, its direction still unit length.
+    Ray ToObject(const Ray& ray) const;
+    // Distance along the world ray of a hit at t along the object ray.
+    float ToWorld(float t) const { return shift + t * scale; }
+};
+
+struct InstanceNode {
+    BoundingBox bounds;
+    // Interior: index of the left child, the right child is always left + 1. -1 for leaves.
+    int child;
+    // Leaf: range in InstanceTree::instances.
+    int first;
+    int count;
+};
+
+// Top level accelerator: a BVH over the world bounds of the instances, each leaf handing the ray on to the
+// bottom level accelerators of its instances. Cheap enough to rebuild for every render, which is all moving
+// an instance costs.
+struct InstanceTree {
+    vector<InstanceRecord> instances;
+    vector<InstanceNode> nodes;
+
+    bool Empty() const { return instances.empty(); }
+    // Builds the bottom levels it doesn't have yet with the given accelerator type.
+    void Build(const vector<Instance*>& scene_instances, int accelerator_type);
+    // Replaces *intersection if an instance is hit closer than t_max.
+    bool FindIntersection(const Ray& ray, float t_max, HitInformation* intersection) const;
+    bool Occluded(const Ray& ray, float t_max) const;
+
+  private:
+    void Subdivide(int node_i, int first, int count);
+};
+
+}  // namespace Raytracer
+
+#endif
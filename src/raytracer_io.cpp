@@ -1,104 +1,187 @@
-#include "raytracer_main.h"
+#include "raytracer_render.h"
+
+#include <cassert>
+#include <filesystem>
+#include <string.h>
+#include <string_view>
+#include <thread>
+#include "raytracer_mapped_file.h"
 
 namespace Raytracer {
 
 LoadState load_state{};
 
-string rest_if_prefix(const string prefix, string content) {
-    return content.compare(0, prefix.length(), prefix) == 0 ? content.substr(prefix.length()) : "";
+// Lines per thread below which vertices are parsed on the loading thread alone.
+#define PARSE_CHUNK_LINES 8192
+
+SceneKey FindSceneKey(const char* begin, const char* end, const char** rest) {
+    const char* colon = (const char*)memchr(begin, ':', end - begin);
+    // The loader has always required "key: " followed by something.
+    if (colon == NULL || colon + 2 >= end || colon[1] != ' ')
+        return KEY_NONE;
+    *rest = colon + 2;
+
+    string_view key(begin, colon - begin);
+    switch (*begin) {
+        case 'a':
+            if (key == "ambient_light") return KEY_AMBIENT_LIGHT;
+            break;
+        case 'b':
+            if (key == "background") return KEY_BACKGROUND;
+            break;
+        case 'c':
+            if (key == "camera_pos") return KEY_CAMERA_POS;
+            if (key == "camera_fwd") return KEY_CAMERA_FWD;
+            if (key == "camera_up") return KEY_CAMERA_UP;
+            if (key == "camera_fov_ha") return KEY_CAMERA_FOV_HA;
+            break;
+        case 'd':
+            if (key == "directional_light") return KEY_DIRECTIONAL_LIGHT;
+            break;
+        case 'e':
+            if (key == "end_object") return KEY_END_OBJECT;
+            break;
+        case 'f':
+            if (key == "film_resolution") return KEY_FILM_RESOLUTION;
+            break;
+        case 'i':
+            if (key == "instance") return KEY_INSTANCE;
+            break;
+        case 'm':
+            if (key == "material") return KEY_MATERIAL;
+            if (key == "max_vertices") return KEY_MAX_VERTICES;
+            if (key == "max_normals") return KEY_MAX_NORMALS;
+            if (key == "max_depth") return KEY_MAX_DEPTH;
+            break;
+        case 'n':
+            if (key == "normal") return KEY_NORMAL;
+            if (key == "normal_triangle") return KEY_NORMAL_TRIANGLE;
+            break;
+        case 'o':
+            if (key == "output_image") return KEY_OUTPUT_IMAGE;
+            if (key == "object") return KEY_OBJECT;
+            break;
+        case 'p':
+            if (key == "point_light") return KEY_POINT_LIGHT;
+            break;
+        case 's':
+            if (key == "sphere") return KEY_SPHERE;
+            if (key == "sphere_cloud") return KEY_SPHERE_CLOUD;
+            if (key == "spot_light") return KEY_SPOT_LIGHT;
+            break;
+        case 't':
+            if (key == "triangle") return KEY_TRIANGLE;
+            break;
+        case 'v':
+            if (key == "vertex") return KEY_VERTEX;
+            break;
+    }
+    return KEY_NONE;
 }
 
-vec3 DecodeVertex(string& s) {
-	stringstream ss(s);
+vec3 DecodeVertex(FieldReader in) {
 	vec3 new_vert;
-	ss >> new_vert.x >> new_vert.y >> new_vert.z;
+	in >> new_vert.x >> new_vert.y >> new_vert.z;
 	return new_vert;
 }
 
-void Camera::Decode(string& s) {
-    string rest;
-    rest = rest_if_prefix("camera_pos: ", s);
-    if (rest != "") {
-        stringstream ss(rest);
-        ss >> position.x >> position.y >> position.z;
-    }
-
-    rest = rest_if_prefix("camera_fwd: ", s);
-    if (rest != "") {
-        stringstream ss(rest);
-        ss >> forward.x >> forward.y >> forward.z;
-    }
-
-    rest = rest_if_prefix("camera_up: ", s);
-    if (rest != "") {
-        stringstream ss(rest);
-        ss >> up.x >> up.y >> up.z;
-    }
-
-    rest = rest_if_prefix("camera_fov_ha: ", s);
-    if (rest != "") {
-        stringstream ss(rest);
-        ss >> half_vfov;
-    }
+// Parses the recorded vertex: or normal: lines into out, splitting large blocks across threads.
+static void DecodeVertices(const vector<FieldReader>& fields, vector<vec3>& out, bool normalize) {
+    out.resize(fields.size());
+    auto decode = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            vec3 v = DecodeVertex(fields[i]);
+            out[i] = normalize ? v.normalized() : v;
+        }
+    };
 
-    rest = rest_if_prefix("film_resolution: ", s);
-    if (rest != "") {
-        stringstream ss(rest);
-        ss >> res.x >> res.y;
+    size_t chunks = min((size_t)HardwareThreads(), fields.size() / PARSE_CHUNK_LINES);
+    if (chunks <= 1) {
+        decode(0, fields.size());
+        return;
     }
-
-    rest = rest_if_prefix("output_image: ", s);
-    if (rest != "") {
-        stringstream ss(rest);
-        ss >> output_name;
+    vector<thread> threads;
+    for (size_t c = 1; c < chunks; c++) {
+        threads.push_back(thread(decode, fields.size() * c / chunks, fields.size() * (c + 1) / chunks));
     }
-
-    rest = rest_if_prefix("background: ", s);
-    if (rest != "") {
-        stringstream ss(rest);
-        ss >> background_color.r >> background_color.g >> background_color.b;
+    decode(0, fields.size() / chunks);
+    for (thread& t : threads) {
+        t.join();
     }
+}
 
-    rest = rest_if_prefix("max_depth: ", s);
-    if (rest != "") {
-        stringstream ss(rest);
-        ss >> max_depth;
+void Camera::Decode(SceneKey key, FieldReader& in) {
+    switch (key) {
+        case KEY_CAMERA_POS:
+            in >> position.x >> position.y >> position.z;
+            break;
+        case KEY_CAMERA_FWD:
+            in >> forward.x >> forward.y >> forward.z;
+            break;
+        case KEY_CAMERA_UP:
+            in >> up.x >> up.y >> up.z;
+            break;
+        case KEY_CAMERA_FOV_HA:
+            in >> half_vfov;
+            break;
+        case KEY_FILM_RESOLUTION:
+            in >> res.x >> res.y;
+            break;
+        case KEY_OUTPUT_IMAGE:
+            in.ReadWord(output_name, CHARARRAY_LEN);
+            break;
+        case KEY_BACKGROUND:
+            in >> background_color.r >> background_color.g >> background_color.b;
+            break;
+        case KEY_MAX_DEPTH:
+            in >> max_depth;
+            break;
+        default:
+            break;
     }
 }
 
-void Material::Decode(string& s) {
-    stringstream ss(s);
-    ss >> ambient.r >> ambient.g >> ambient.b >> diffuse.r >> diffuse.g >> diffuse.b >> specular.r >> specular.g >>
+void Material::Decode(FieldReader& in) {
+    in >> ambient.r >> ambient.g >> ambient.b >> diffuse.r >> diffuse.g >> diffuse.b >> specular.r >> specular.g >>
         specular.b >> phong >> transmissive.r >> transmissive.g >> transmissive.b >> ior;
 }
 
-void Geometry::Decode(string& s) {}
+void Geometry::Decode(FieldReader& in) {}
 
-void Sphere::Decode(string& s) {
-    stringstream ss(s);
-    ss >> position.x >> position.y >> position.z >> radius;
+void Sphere::Decode(FieldReader& in) {
+    in >> position.x >> position.y >> position.z >> radius;
 }
 
-void Triangle::Decode(string& s) {
-	stringstream ss(s);
+void SphereCloud::Decode(FieldReader& in) {
+	while (true) {
+		vec3 center;
+		float radius;
+		in >> center.x >> center.y >> center.z >> radius;
+		if (!in.ok)
+			break;
+		centers.push_back(center);
+		radii.push_back(radius);
+	}
+}
+
+void Triangle::Decode(FieldReader& in) {
 	int i_v1, i_v2, i_v3;
-	ss >> i_v1 >> i_v2 >> i_v3;
+	in >> i_v1 >> i_v2 >> i_v3;
     int vsize = load_state.vertices.size();
-	IM_ASSERT(i_v1 < vsize && i_v2 < vsize && i_v3 < vsize);
+	assert(i_v1 < vsize && i_v2 < vsize && i_v3 < vsize);
 	v1 = load_state.vertices.at(i_v1);
 	v2 = load_state.vertices.at(i_v2);
 	v3 = load_state.vertices.at(i_v3);
 }
 
 
-void NormalTriangle::Decode(string& s) {
-	stringstream ss(s);
+void NormalTriangle::Decode(FieldReader& in) {
 	int i_v1, i_v2, i_v3, i_n1, i_n2, i_n3;
-	ss >> i_v1 >> i_v2 >> i_v3 >> i_n1 >> i_n2 >> i_n3;
+	in >> i_v1 >> i_v2 >> i_v3 >> i_n1 >> i_n2 >> i_n3;
     int vsize = load_state.vertices.size();
     int nsize = load_state.normals.size();
-	IM_ASSERT(i_v1 < vsize && i_v2 < vsize && i_v3 < vsize);
-	IM_ASSERT(i_n1 < nsize && i_n2 < nsize && i_n3 < nsize);
+	assert(i_v1 < vsize && i_v2 < vsize && i_v3 < vsize);
+	assert(i_n1 < nsize && i_n2 < nsize && i_n3 < nsize);
 	v1 = load_state.vertices.at(i_v1);
 	v2 = load_state.vertices.at(i_v2);
 	v3 = load_state.vertices.at(i_v3);
@@ -107,253 +190,447 @@ void NormalTriangle::Decode(string& s) {
 	n3 = load_state.normals.at(i_n3).normalized();
 }
 
-void Light::Decode(string& s) {
-    stringstream ss(s);
-    ss >> color.r >> color.g >> color.b;
-    ClampColor();
-
-    getline(ss, s);
+// Indices may only refer to vertex: and normal: lines above this one, which LoadFile has recorded but not parsed yet.
+void Mesh::Decode(FieldReader& in) {
+	uint32_t i_v[3], i_n[3];
+	in >> i_v[0] >> i_v[1] >> i_v[2];
+	uint32_t vsize = load_state.vertex_fields.size();
+	assert(i_v[0] < vsize && i_v[1] < vsize && i_v[2] < vsize);
+	vertex_indices.insert(vertex_indices.end(), i_v, i_v + 3);
+	if (smooth) {
+		in >> i_n[0] >> i_n[1] >> i_n[2];
+		uint32_t nsize = load_state.normal_fields.size();
+		assert(i_n[0] < nsize && i_n[1] < nsize && i_n[2] < nsize);
+		normal_indices.insert(normal_indices.end(), i_n, i_n + 3);
+	}
 }
 
-void AmbientLight::Decode(string& s) {
-    Light::Decode(s);
+// Leaves in after the color, for the subclasses to read the rest of the line.
+void Light::Decode(FieldReader& in) {
+    in >> color.r >> color.g >> color.b;
+    ClampColor();
 }
 
-void PointLight::Decode(string& s) {
-    Light::Decode(s);
-    stringstream ss(s);
-    ss >> position.x >> position.y >> position.z;
+void AmbientLight::Decode(FieldReader& in) {
+    Light::Decode(in);
 }
 
-void DirectionalLight::Decode(string& s) {
-    Light::Decode(s);
-    stringstream ss(s);
-    ss >> direction.x >> direction.y >> direction.z;
+void PointLight::Decode(FieldReader& in) {
+    Light::Decode(in);
+    in >> position.x >> position.y >> position.z;
 }
 
-void SpotLight::Decode(string& s) {
-    Light::Decode(s);
-    stringstream ss(s);
-    ss >> position.x >> position.y >> position.z >> direction.x >> direction.y >> direction.z >> angle1 >> angle2;
+void DirectionalLight::Decode(FieldReader& in) {
+    Light::Decode(in);
+    in >> direction.x >> direction.y >> direction.z;
 }
 
-string Camera::Encode() {
-    ostringstream oss;
-    ossstream osss(oss);
-
-    osss << "camera_pos:" << position.x << position.y << position.z;
-    osss << "camera_fwd:" << forward.x << forward.y << forward.z;
-    osss << "camera_up:" << up.x << up.y << up.z;
-    osss << "camera_fov_ha:" << half_vfov;
-    osss << "film_resolution:" << res.x << res.y;
-    osss << "output_image: ";
-	oss << output_name;
-    osss << "background:" << background_color.r << background_color.g << background_color.b;
-    osss << "max_depth:" << max_depth << "";
-
-    return oss.str();
+void SpotLight::Decode(FieldReader& in) {
+    Light::Decode(in);
+    in >> position.x >> position.y >> position.z >> direction.x >> direction.y >> direction.z >> angle1 >> angle2;
 }
 
-string Material::Encode() {
-    ostringstream oss;
-	oss << "material:";
-    ossstream osss(oss);
-    osss << ambient.r << ambient.g << ambient.b << diffuse.r << diffuse.g << diffuse.b << specular.r << specular.g
-        << specular.b << phong << transmissive.r << transmissive.g << transmissive.b << ior;
-    return oss.str();
+void Camera::Encode(SceneWriter& out) {
+    out << "camera_pos:" << position;
+    out << "camera_fwd:" << forward;
+    out << "camera_up:" << up;
+    out << "camera_fov_ha:" << half_vfov;
+    out << "film_resolution:" << res.x << res.y;
+    out << "output_image:";
+    out.Word(output_name);
+    out << "background:" << background_color;
+    out << "max_depth:" << max_depth;
 }
 
-string Geometry::Encode() {
-    string temp = "\n" + material->Encode() + "\n";
-    return temp;
+// Materials are written by the shapes that use them, through SceneWriter::UseMaterial().
+void Material::Encode(SceneWriter& out) {
+    out.UseMaterial(this);
 }
 
-string Sphere::Encode() {
-    ostringstream oss;
-	oss << Geometry::Encode() << "sphere:";
-    ossstream osss(oss);
-    osss << position.x << position.y << position.z << radius;
-    return oss.str();
+void Geometry::Encode(SceneWriter& out) {
+    out.UseMaterial(material);
 }
 
-string Triangle::Encode() {
-    ostringstream oss;
-	oss << Geometry::Encode() << endl;
-    oss << v1.keyed_string("vertex: ") << endl;
-	oss << v2.keyed_string("vertex: ") << endl;
-	oss << v3.keyed_string("vertex: ");
-	ossstream osss(oss);
-    osss << "triangle:" << load_state.vertex_i++ << load_state.vertex_i++ << load_state.vertex_i++;
-    return oss.str();
+void Sphere::Encode(SceneWriter& out) {
+    Geometry::Encode(out);
+    out << "sphere:" << position << radius;
 }
 
-string NormalTriangle::Encode() {
-    ostringstream oss;
-	oss << Geometry::Encode() << endl;
-    oss << v1.keyed_string("vertex: ") << endl;
-	oss << v2.keyed_string("vertex: ") << endl;
-	oss << v3.keyed_string("vertex: ") << endl;
-	oss << n1.keyed_string("normal: ") << endl;
-	oss << n2.keyed_string("normal: ") << endl;
-	oss << n3.keyed_string("normal: ");
-	ossstream osss(oss);
-    osss << "normal_triangle:" << load_state.vertex_i++ << load_state.vertex_i++ << load_state.vertex_i++
-		 << load_state.normal_i++ << load_state.normal_i++ << load_state.normal_i++;
-    return oss.str();
+void SphereCloud::Encode(SceneWriter& out) {
+    Geometry::Encode(out);
+    for (int i = 0; i < SphereCount(); i++) {
+        out << "sphere:" << centers[i] << radii[i];
+    }
 }
 
-string Light::Encode() {
-    ostringstream oss;
-    ossstream osss(oss);
-    osss << color.r * mult << color.g * mult << color.b * mult;
-    return oss.str();
+void Prototype::Encode(SceneWriter& out) {
+    out << "object:";
+    out.Word(name.c_str());
+    for (Geometry* geo : shapes) {
+        geo->Encode(out);
+    }
+    out << "end_object:";
+    out.Word(name.c_str());
 }
 
-string AmbientLight::Encode() {
-    string temp = "ambient_light:" + Light::Encode();
-    return temp;
+// No material: line, the prototype's shapes carry their own.
+void Instance::Encode(SceneWriter& out) {
+    out << "instance:";
+    out.Word(prototype->name.c_str());
+    out << position << rotation << scale;
 }
 
-string DirectionalLight::Encode() {
-    ostringstream oss;
-	oss << "directional_light:" << Light::Encode();
-    ossstream osss(oss);
-    osss << direction.x << direction.y << direction.z;
-    return oss.str();
+void Instance::Decode(FieldReader& in) {
+    in >> position.x >> position.y >> position.z;
+    // Rotation and scale may be left off.
+    vec3 new_rotation;
+    in >> new_rotation.x >> new_rotation.y >> new_rotation.z;
+    if (in.ok)
+        rotation = new_rotation;
+    float new_scale = 0;
+    in >> new_scale;
+    if (in.ok && new_scale > 0)
+        scale = new_scale;
 }
 
-string PointLight::Encode() {
-    ostringstream oss;
-	oss << "point_light:" << Light::Encode();
-    ossstream osss(oss);
-    osss << position.x << position.y << position.z;
-    return oss.str();
+void Triangle::Encode(SceneWriter& out) {
+    Geometry::Encode(out);
+    uint32_t i_v1 = out.Vertex(v1), i_v2 = out.Vertex(v2), i_v3 = out.Vertex(v3);
+    out << "triangle:" << i_v1 << i_v2 << i_v3;
 }
 
-string SpotLight::Encode() {
-    ostringstream oss;
-	oss << "spot_light:" << Light::Encode();
-    ossstream osss(oss);
-    osss << position.x << position.y << position.z << direction.x << direction.y << direction.z << angle1 << angle2;
-    return oss.str();
+void NormalTriangle::Encode(SceneWriter& out) {
+    Geometry::Encode(out);
+    uint32_t i_v1 = out.Vertex(v1), i_v2 = out.Vertex(v2), i_v3 = out.Vertex(v3);
+    uint32_t i_n1 = out.Normal(n1), i_n2 = out.Normal(n2), i_n3 = out.Normal(n3);
+    out << "normal_triangle:" << i_v1 << i_v2 << i_v3 << i_n1 << i_n2 << i_n3;
 }
 
-void Load() {
-    Reset();
-
-    string scene_string = "scenes/" + string(scene_name) + ".p3";
-
-    ifstream scene_file(scene_string);
-    if (!scene_file.is_open())
-        return;
+// The vertex and normal buffers are written once for all the meshes sharing them, and the triangles keep their indices.
+void Mesh::Encode(SceneWriter& out) {
+    Geometry::Encode(out);
+    uint32_t v = out.VertexBuffer(positions.get());
+    uint32_t n = smooth ? out.NormalBuffer(normals.get()) : 0;
+    for (int i = 0; i < TriangleCount(); i++) {
+        const uint32_t* tri_v = &vertex_indices[3 * i];
+        if (smooth) {
+            const uint32_t* tri_n = &normal_indices[3 * i];
+            out << "normal_triangle:" << v + tri_v[0] << v + tri_v[1] << v + tri_v[2] << n + tri_n[0] << n + tri_n[1] << n + tri_n[2];
+        } else {
+            out << "triangle:" << v + tri_v[0] << v + tri_v[1] << v + tri_v[2];
+        }
+    }
+}
 
-    string line;
-    while (getline(scene_file, line)) {
-        string rest;
+// Writes the color with mult applied, after the key the subclasses write.
+void Light::Encode(SceneWriter& out) {
+    out << color * mult;
+}
 
-        // Only camera can Decode this way because only camera is pseudostatic
-		// It does decode this way because otherwise we would need to check every line for all of its keys
-        camera->Decode(line);
+void AmbientLight::Encode(SceneWriter& out) {
+    out << "ambient_light:";
+    Light::Encode(out);
+}
 
-		rest = rest_if_prefix("vertex: ", line);
-        if (rest != "") {
-            vec3 v = DecodeVertex(rest);
-            load_state.vertices.push_back(v);
-        }
+void DirectionalLight::Encode(SceneWriter& out) {
+    out << "directional_light:";
+    Light::Encode(out);
+    out << direction;
+}
 
-		rest = rest_if_prefix("normal: ", line);
-        if (rest != "") {
-            vec3 v = DecodeVertex(rest).normalized();
-            load_state.normals.push_back(v);
-        }
+void PointLight::Encode(SceneWriter& out) {
+    out << "point_light:";
+    Light::Encode(out);
+    out << position;
+}
 
-        rest = rest_if_prefix("sphere: ", line);
-        if (rest != "") {
-            Sphere* new_sphere = new Sphere(&entity_count, materials.back());
-            new_sphere->Decode(rest);
-            shapes.push_back(new_sphere);
-        }
+void SpotLight::Encode(SceneWriter& out) {
+    out << "spot_light:";
+    Light::Encode(out);
+    out << position << direction << angle1 << angle2;
+}
 
-		rest = rest_if_prefix("triangle: ", line);
-        if (rest != "") {
-            Triangle* new_triangle = new Triangle(&entity_count, materials.back());
-            new_triangle->Decode(rest);
-            shapes.push_back(new_triangle);
-        }
+// Consecutive triangles with the same material and shading are collected into one mesh.
+// Where loaded shapes go: the object being read, if any, or the scene.
+static vector<Geometry*>& LoadTarget() {
+    return load_state.prototype ? load_state.prototype->shapes : shapes;
+}
 
-		rest = rest_if_prefix("normal_triangle: ", line);
-        if (rest != "") {
-            NormalTriangle* new_triangle = new NormalTriangle(&entity_count, materials.back());
-            new_triangle->Decode(rest);
-            shapes.push_back(new_triangle);
-        }
+Mesh* MeshFor(Material* mat, bool smooth) {
+    if (load_state.meshes.size() > load_state.first_mesh) {
+        Mesh* last = load_state.meshes.back();
+        if (last->material == mat && last->smooth == smooth)
+            return last;
+    }
+    Mesh* mesh = new Mesh(&entity_count, mat);
+    mesh->smooth = smooth;
+    LoadTarget().push_back(mesh);
+    load_state.meshes.push_back(mesh);
+    return mesh;
+}
 
-        rest = rest_if_prefix("material: ", line);
-        if (rest != "") {
-            Material* new_mat = new Material(&entity_count);
-            new_mat->Decode(rest);
-            materials.push_back(new_mat);
-        }
+// Consecutive spheres with the same material are collected into one cloud, like triangles into meshes.
+SphereCloud* CloudFor(Material* mat) {
+    if (load_state.clouds.size() > load_state.first_cloud) {
+        SphereCloud* last = load_state.clouds.back();
+        if (last->material == mat)
+            return last;
+    }
+    SphereCloud* cloud = new SphereCloud(&entity_count, mat);
+    LoadTarget().push_back(cloud);
+    load_state.clouds.push_back(cloud);
+    return cloud;
+}
 
-        rest = rest_if_prefix("ambient_light: ", line);
-        if (rest != "") {
-            AmbientLight* new_light = new AmbientLight(&entity_count);
-            new_light->Decode(rest);
-            lights.push_back(new_light);
-        }
+// Opens an object for the shapes that follow, or with name NULL closes the open one, if any.
+static void BeginObject(const char* name) {
+    if (load_state.prototype) {
+        load_state.prototype->Finish();
+        prototypes.push_back(load_state.prototype);
+        load_state.prototype = NULL;
+    }
+    if (name != NULL)
+        load_state.prototype = make_shared<Prototype>(name);
+    // Shapes inside an object never merge with those outside it.
+    load_state.first_mesh = load_state.meshes.size();
+    load_state.first_cloud = load_state.clouds.size();
+}
 
-        rest = rest_if_prefix("directional_light: ", line);
-        if (rest != "") {
-            DirectionalLight* new_light = new DirectionalLight(&entity_count);
-            new_light->Decode(rest);
-            lights.push_back(new_light);
-        }
+static shared_ptr<Prototype> FindPrototype(const char* name) {
+    for (shared_ptr<Prototype>& prototype : prototypes) {
+        if (prototype->name == name)
+            return prototype;
+    }
+    return NULL;
+}
 
-        rest = rest_if_prefix("point_light: ", line);
-        if (rest != "") {
-            PointLight* new_light = new PointLight(&entity_count);
-            new_light->Decode(rest);
-            lights.push_back(new_light);
+bool LoadFile(const string& path) {
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".p3b") == 0)
+        return LoadBinaryFile(path);
+    Reset();
+    load_state.material = materials.front();
+
+    steady_clock::time_point load_start = steady_clock::now();
+    MappedFile scene_file;
+    if (!scene_file.Open(path))
+        return false;
+
+    const char* file_end = scene_file.data + scene_file.size;
+    const char* line = scene_file.data;
+    while (line < file_end) {
+        const char* line_end = (const char*)memchr(line, '\n', file_end - line);
+        if (line_end == NULL)
+            line_end = file_end;
+
+        const char* rest;
+        SceneKey key = FindSceneKey(line, line_end, &rest);
+        FieldReader in(rest, line_end);
+        switch (key) {
+            case KEY_NONE:
+                break;
+
+            case KEY_CAMERA_POS:
+            case KEY_CAMERA_FWD:
+            case KEY_CAMERA_UP:
+            case KEY_CAMERA_FOV_HA:
+            case KEY_FILM_RESOLUTION:
+            case KEY_OUTPUT_IMAGE:
+            case KEY_BACKGROUND:
+            case KEY_MAX_DEPTH:
+                camera->Decode(key, in);
+                break;
+
+            case KEY_MAX_VERTICES:
+            case KEY_MAX_NORMALS: {
+                int hint = 0;
+                in >> hint;
+                if (in.ok && hint > 0) {
+                    (key == KEY_MAX_VERTICES ? load_state.vertices : load_state.normals).reserve(hint);
+                    (key == KEY_MAX_VERTICES ? load_state.vertex_fields : load_state.normal_fields).reserve(hint);
+                }
+                break;
+            }
+
+            case KEY_VERTEX:
+                load_state.vertex_fields.push_back(in);
+                break;
+
+            case KEY_NORMAL:
+                load_state.normal_fields.push_back(in);
+                break;
+
+            case KEY_SPHERE:
+            case KEY_SPHERE_CLOUD:
+                CloudFor(load_state.material)->Decode(in);
+                break;
+
+            case KEY_TRIANGLE:
+                MeshFor(load_state.material, false)->Decode(in);
+                break;
+
+            case KEY_NORMAL_TRIANGLE:
+                MeshFor(load_state.material, true)->Decode(in);
+                break;
+
+            case KEY_MATERIAL: {
+                Material new_mat(0);
+                new_mat.Decode(in);
+                // Saved scenes repeat the material before every triangle. Interning hands back the same one,
+                // which keeps those triangles in one mesh.
+                load_state.material = InternMaterial(new_mat);
+                break;
+            }
+
+            case KEY_OBJECT: {
+                char name[CHARARRAY_LEN];
+                in.ReadWord(name, CHARARRAY_LEN);
+                if (in.ok)
+                    BeginObject(name);
+                break;
+            }
+
+            case KEY_END_OBJECT:
+                BeginObject(NULL);
+                break;
+
+            case KEY_INSTANCE: {
+                char name[CHARARRAY_LEN];
+                in.ReadWord(name, CHARARRAY_LEN);
+                shared_ptr<Prototype> prototype = in.ok ? FindPrototype(name) : NULL;
+                if (!prototype) {
+                    Log("instance of unknown object " + string(in.ok ? name : ""));
+                    break;
+                }
+                Instance* instance = new Instance(&entity_count, prototype);
+                instance->Decode(in);
+                // Instances are placed in the scene, even inside another object's lines.
+                shapes.push_back(instance);
+                break;
+            }
+
+            case KEY_AMBIENT_LIGHT: {
+                AmbientLight* new_light = new AmbientLight(&entity_count);
+                new_light->Decode(in);
+                lights.push_back(new_light);
+                break;
+            }
+
+            case KEY_DIRECTIONAL_LIGHT: {
+                DirectionalLight* new_light = new DirectionalLight(&entity_count);
+                new_light->Decode(in);
+                lights.push_back(new_light);
+                break;
+            }
+
+            case KEY_POINT_LIGHT: {
+                PointLight* new_light = new PointLight(&entity_count);
+                new_light->Decode(in);
+                lights.push_back(new_light);
+                break;
+            }
+
+            case KEY_SPOT_LIGHT: {
+                SpotLight* new_light = new SpotLight(&entity_count);
+                new_light->Decode(in);
+                lights.push_back(new_light);
+                break;
+            }
         }
-
-        rest = rest_if_prefix("spot_light: ", line);
-        if (rest != "") {
-            SpotLight* new_light = new SpotLight(&entity_count);
-            new_light->Decode(rest);
-            lights.push_back(new_light);
+        line = line_end + 1;
+    }
+    // An object left open runs to the end of the file.
+    BeginObject(NULL);
+
+    DecodeVertices(load_state.vertex_fields, load_state.vertices, false);
+    DecodeVertices(load_state.normal_fields, load_state.normals, true);
+    load_state.vertex_fields = vector<FieldReader>();
+    load_state.normal_fields = vector<FieldReader>();
+
+    shared_ptr<const vector<vec3>> positions = make_shared<const vector<vec3>>(move(load_state.vertices));
+    shared_ptr<const vector<vec3>> normals = make_shared<const vector<vec3>>(move(load_state.normals));
+    size_t triangle_count = 0;
+    for (Mesh* mesh : load_state.meshes) {
+        mesh->positions = positions;
+        mesh->normals = normals;
+        triangle_count += mesh->TriangleCount();
+    }
+    if (!load_state.meshes.empty())
+        Log("Loaded " + to_string(triangle_count) + " triangles into " + to_string(load_state.meshes.size()) + " meshes");
+    size_t sphere_count = 0;
+    for (SphereCloud* cloud : load_state.clouds) {
+        sphere_count += cloud->SphereCount();
+    }
+    if (!load_state.clouds.empty())
+        Log("Loaded " + to_string(sphere_count) + " spheres into " + to_string(load_state.clouds.size()) + " clouds");
+    if (!prototypes.empty()) {
+        size_t instance_count = 0;
+        for (Geometry* geo : shapes) {
+            if (dynamic_cast<Instance*>(geo))
+                instance_count++;
         }
+        Log("Loaded " + to_string(prototypes.size()) + " objects placed by " + to_string(instance_count) + " instances");
     }
-    scene_file.close();
 
-    UpdateCameraWidget();
-	RequestRender();
+    float load_s = duration<float>(steady_clock::now() - load_start).count();
+    float megabytes = scene_file.size / (1024.0f * 1024.0f);
+    Log("Read " + to_string(megabytes) + "MB in " + to_string(load_s) + "s, " + to_string(megabytes / fmax(load_s, 1e-6)) + " MB/s");
+    return true;
+}
+
+void Load() {
+    string text_path = "scenes/" + string(scene_name) + ".p3";
+    string binary_path = text_path + "b";
+    error_code text_error, binary_error;
+    filesystem::file_time_type text_time = filesystem::last_write_time(text_path, text_error);
+    filesystem::file_time_type binary_time = filesystem::last_write_time(binary_path, binary_error);
+    // A binary file from an older version is refused, the text it was saved next to still loads.
+    if (!binary_error && (text_error || binary_time >= text_time) && (LoadFile(binary_path) || text_error))
+        return;
+    LoadFile(text_path);
 }
 
 void Save() {
-    load_state = LoadState();
     if (string(scene_name) == "") {
         return;
     }
 
     string scene_string = "scenes/" + string(scene_name) + ".p3";
 
+    steady_clock::time_point save_start = steady_clock::now();
     ofstream scene_file(scene_string);
     if (!scene_file.is_open()) {
         return;
     }
 
-    scene_file << camera->Encode() << endl;
+    SceneWriter out(scene_file);
+    camera->Encode(out);
+
+    // Ahead of the instances that place them.
+    for (shared_ptr<Prototype>& prototype : prototypes) {
+        prototype->Encode(out);
+    }
 
     for (Geometry* geo : shapes) {
-        scene_file << geo->Encode() << endl;
+        geo->Encode(out);
     }
 
     for (Light* light : lights) {
-        scene_file << light->Encode() << endl;
+        light->Encode(out);
     }
 
+    out.Finish();
     scene_file.close();
+
+    float save_s = duration<float>(steady_clock::now() - save_start).count();
+    Log("Wrote " + to_string(out.BytesWritten() / (1024.0f * 1024.0f)) + "MB in " + to_string(save_s) + "s");
+}
+
+void SaveBinary() {
+    if (string(scene_name) == "") {
+        return;
+    }
+    SaveBinaryFile("scenes/" + string(scene_name) + ".p3b");
 }
 
 
-}  // namespace Raytracer
\ No newline at end of file
+}  // namespace Raytracer
\ No newline at end of file
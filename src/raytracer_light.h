@@ -12,6 +12,14 @@ const float PI = 3.1415926536;
 
 namespace Raytracer {
 
+enum LightType {
+    LIGHT_NONE,
+    LIGHT_AMBIENT,
+    LIGHT_DIRECTIONAL,
+    LIGHT_POINT,
+    LIGHT_SPOT
+};
+
 // Non-enforced abstract class for lights
 struct Light : Object {
     Color color = Color(1, 1, 1);
@@ -21,9 +29,15 @@ struct Light : Object {
 
     using Object::Object;
 
+#ifndef RAYTRACER_HEADLESS
     void ImGui();
-    string Encode();
-    void Decode(string& s);
+#endif
+    void Encode(SceneWriter& out);
+    void Decode(FieldReader& in);
+    // Copy for a render snapshot.
+    virtual Light* Clone() const { return new Light(*this); }
+    // Which subclass this is, so renders can sort lights without a dynamic_cast per light.
+    virtual LightType Type() const { return LIGHT_NONE; }
 
     // Non-enforced abstract
     virtual Ray ReverseLightRay(vec3 from) { return Ray(vec3(), vec3(), -1); }
@@ -34,9 +48,13 @@ struct Light : Object {
 struct AmbientLight : Light {
     using Light::Light;
 
+#ifndef RAYTRACER_HEADLESS
     void ImGui();
-    string Encode();
-    void Decode(string& s);
+#endif
+    void Encode(SceneWriter& out);
+    void Decode(FieldReader& in);
+    Light* Clone() const { return new AmbientLight(*this); }
+    LightType Type() const { return LIGHT_AMBIENT; }
 };
 
 struct DirectionalLight : Light {
@@ -44,9 +62,13 @@ struct DirectionalLight : Light {
 
     using Light::Light;
 
+#ifndef RAYTRACER_HEADLESS
     void ImGui();
-    string Encode();
-    void Decode(string& s);
+#endif
+    void Encode(SceneWriter& out);
+    void Decode(FieldReader& in);
+    Light* Clone() const { return new DirectionalLight(*this); }
+    LightType Type() const { return LIGHT_DIRECTIONAL; }
 
     Ray ReverseLightRay(vec3 from);
     float DistanceTo2(vec3 to);
@@ -58,9 +80,13 @@ struct PointLight : Light {
 
     using Light::Light;
 
+#ifndef RAYTRACER_HEADLESS
     void ImGui();
-    string Encode();
-    void Decode(string& s);
+#endif
+    void Encode(SceneWriter& out);
+    void Decode(FieldReader& in);
+    Light* Clone() const { return new PointLight(*this); }
+    LightType Type() const { return LIGHT_POINT; }
 
     Ray ReverseLightRay(vec3 from);
     float DistanceTo2(vec3 to);
@@ -75,9 +101,13 @@ struct SpotLight : Light {
 
     using Light::Light;
 
+#ifndef RAYTRACER_HEADLESS
     void ImGui();
-    string Encode();
-    void Decode(string& s);
+#endif
+    void Encode(SceneWriter& out);
+    void Decode(FieldReader& in);
+    Light* Clone() const { return new SpotLight(*this); }
+    LightType Type() const { return LIGHT_SPOT; }
 
     Ray ReverseLightRay(vec3 from);
     float DistanceTo2(vec3 to);
@@ -86,4 +116,4 @@ struct SpotLight : Light {
 
 }  // namespace Raytracer
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -0,0 +1,178 @@
+// Light hierarchy in the spirit of Conty Estevez and Kulla, "Importance Sampling of Many Lights with Adaptive
+// Tree Splitting" (2018), without the orientation bounds.
+
+#include "raytracer_light_tree.h"
+
+#include <algorithm>
+#include "raytracer_sampler.h"
+
+namespace Raytracer {
+
+// Closest a light is treated as being, so a hit right on top of one doesn't take every sample.
+#define LIGHT_TREE_MIN_DIST2 1e-4f
+
+static double Axis(const vec3& v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// What the sampling weights are measured in, in the same units as the light colors.
+static float Power(const Color& c) {
+    return c.r + c.g + c.b;
+}
+
+void LightTree::Build(const vector<Light*>& scene_lights) {
+    nodes.clear();
+    lights.clear();
+    unbounded.clear();
+
+    vector<BuildLight> build_lights;
+    for (Light* light : scene_lights) {
+        switch (light->Type()) {
+            case LIGHT_POINT:
+                build_lights.push_back(BuildLight{light, static_cast<PointLight*>(light)->position, Power(light->color)});
+                break;
+            case LIGHT_SPOT:
+                build_lights.push_back(BuildLight{light, static_cast<SpotLight*>(light)->position, Power(light->color)});
+                break;
+            case LIGHT_AMBIENT:
+                break;
+            default:
+                unbounded.push_back(light);
+        }
+    }
+
+    if (!build_lights.empty()) {
+        nodes.reserve(2 * build_lights.size());
+        nodes.push_back(LightNode{});
+        Subdivide(build_lights, 0, 0, build_lights.size());
+    }
+    lights.reserve(build_lights.size());
+    for (BuildLight& light : build_lights) {
+        lights.push_back(light.light);
+    }
+}
+
+// Splits at the median of the longest axis, so the tree stays balanced whatever the lights look like.
+void LightTree::Subdivide(vector<BuildLight>& build_lights, int node_i, int first, int count) {
+    BoundingBox bounds = BoundingBox::Empty();
+    float power = 0, max_power = 0;
+    for (int i = first; i < first + count; i++) {
+        bounds.Extend(BoundingBox{build_lights[i].position, build_lights[i].position});
+        power += build_lights[i].power;
+        max_power = fmax(max_power, build_lights[i].power);
+    }
+    nodes[node_i].bounds = bounds;
+    nodes[node_i].power = power;
+    nodes[node_i].max_power = max_power;
+    nodes[node_i].child = -1;
+    nodes[node_i].light = first;
+    if (count == 1)
+        return;
+
+    vec3 extent = bounds.max - bounds.min;
+    int axis = 0;
+    if (extent.y > Axis(extent, axis)) axis = 1;
+    if (extent.z > Axis(extent, axis)) axis = 2;
+    int half = count / 2;
+    nth_element(build_lights.begin() + first, build_lights.begin() + first + half, build_lights.begin() + first + count,
+                [axis](const BuildLight& a, const BuildLight& b) {
+                    return Axis(a.position, axis) < Axis(b.position, axis);
+                });
+
+    int left = nodes.size();
+    nodes[node_i].child = left;
+    nodes.push_back(LightNode{});
+    nodes.push_back(LightNode{});
+    Subdivide(build_lights, left, first, half);
+    Subdivide(build_lights, left + 1, first + half, count - half);
+}
+
+// Estimated light of a node at pos. Measured to the center of the node, but never closer than half its
+// diagonal, so a point inside a large node doesn't count it as right on top of every light in it.
+static float Importance(const LightNode& node, const vec3& pos) {
+    vec3 half = (node.bounds.max - node.bounds.min) * 0.5;
+    float dist2 = fmax((node.bounds.Centroid() - pos).mag2(), half.mag2());
+    return node.power / fmax(dist2, LIGHT_TREE_MIN_DIST2);
+}
+
+// Most light any one light under node can give pos, measured to the closest point of the node.
+static float ImportanceBound(const LightNode& node, const vec3& pos) {
+    vec3 closest(fmin(fmax(pos.x, node.bounds.min.x), node.bounds.max.x),
+                 fmin(fmax(pos.y, node.bounds.min.y), node.bounds.max.y),
+                 fmin(fmax(pos.z, node.bounds.min.z), node.bounds.max.z));
+    return node.max_power / fmax((closest - pos).mag2(), LIGHT_TREE_MIN_DIST2);
+}
+
+void LightTree::Sample(const vec3& pos, int count, uint64_t seed, vector<LightChoice>* out) const {
+    for (Light* light : unbounded) {
+        out->push_back(LightChoice{light, 1});
+    }
+    // Picking every light would only add noise.
+    if (count >= (int)lights.size()) {
+        for (Light* light : lights) {
+            out->push_back(LightChoice{light, 1});
+        }
+        return;
+    }
+
+    PCG32 rng(SAMPLER_SEED, seed);
+    for (int sample = 0; sample < count; sample++) {
+        float u = rng.NextFloat();
+        float pdf = 1;
+        int node_i = 0;
+        while (nodes[node_i].child != -1) {
+            int left = nodes[node_i].child;
+            float left_importance = Importance(nodes[left], pos);
+            float right_importance = Importance(nodes[left + 1], pos);
+            float total = left_importance + right_importance;
+            float p_left = total > 0 ? left_importance / total : 0.5f;
+            // Reuses u for every level by stretching the part that was picked back over [0, 1).
+            if (u < p_left) {
+                node_i = left;
+                pdf *= p_left;
+                u = u / p_left;
+            } else {
+                node_i = left + 1;
+                pdf *= 1 - p_left;
+                u = (u - p_left) / (1 - p_left);
+            }
+            u = fmin(u, 0.99999994f);
+        }
+        out->push_back(LightChoice{lights[nodes[node_i].light], 1 / (pdf * count)});
+    }
+}
+
+void LightTree::TopK(const vec3& pos, int count, vector<LightChoice>* out) const {
+    for (Light* light : unbounded) {
+        out->push_back(LightChoice{light, 1});
+    }
+    if (count >= (int)lights.size()) {
+        for (Light* light : lights) {
+            out->push_back(LightChoice{light, 1});
+        }
+        return;
+    }
+
+    // Best first: a node's bound is at least that of anything under it, so leaves come off the heap brightest first.
+    thread_local vector<pair<float, int>> heap;
+    heap.clear();
+    heap.push_back({ImportanceBound(nodes[0], pos), 0});
+    int taken = 0;
+    while (!heap.empty() && taken < count) {
+        pop_heap(heap.begin(), heap.end());
+        int node_i = heap.back().second;
+        heap.pop_back();
+        const LightNode& node = nodes[node_i];
+        if (node.child == -1) {
+            out->push_back(LightChoice{lights[node.light], 1});
+            taken++;
+            continue;
+        }
+        for (int child = node.child; child < node.child + 2; child++) {
+            heap.push_back({ImportanceBound(nodes[child], pos), child});
+            push_heap(heap.begin(), heap.end());
+        }
+    }
+}
+
+}  // namespace Raytracer
@@ -0,0 +1,67 @@
+#ifndef _RAYTRACER_LIGHT_TREE_H
+#define _RAYTRACER_LIGHT_TREE_H
+
+#include <stdint.h>
+#include <vector>
+#include <vec3.h>
+#include "raytracer_geometry.h"
+#include "raytracer_light.h"
+
+using namespace std;
+
+namespace Raytracer {
+
+// A light to shade a hit with, and what its light is multiplied by.
+struct LightChoice {
+    Light* light;
+    float weight;
+};
+
+struct LightNode {
+    BoundingBox bounds;
+    // Sum of the color of every light under the node, ignoring distance.
+    float power;
+    // Power of the brightest single light under the node.
+    float max_power;
+    // Interior: index of the left child, the right child is always left + 1. -1 for leaves.
+    int child;
+    // Leaf: index into LightTree::lights.
+    int light;
+};
+
+// Bounding volume hierarchy over the point and spot lights of a snapshot, with the power of the lights under
+// every node. Lets a hit be shaded with a few lights picked by how much they are likely to add, so shading
+// costs about the same with ten lights as with a thousand.
+//
+// A node's importance to a point is its power over the squared distance to its center, kept from growing past
+// what the node's own size allows. Sample() walks down picking children in proportion to it, which gives every
+// light a nonzero chance, and weights each pick by one over that chance, so the average is the sum over all
+// lights. TopK() instead takes the count most important lights outright: no noise, but the dim tail is dropped.
+struct LightTree {
+    vector<LightNode> nodes;
+    // Point and spot lights, in leaf order.
+    vector<Light*> lights;
+    // Lights without a position, like directional lights. Every hit is shaded with all of them.
+    vector<Light*> unbounded;
+
+    // Ambient lights are left out, they are added by CalculateAmbient().
+    void Build(const vector<Light*>& scene_lights);
+    // Appends count lights picked at random for the point pos, and the unbounded lights. seed picks the
+    // random numbers, so the same seed picks the same lights.
+    void Sample(const vec3& pos, int count, uint64_t seed, vector<LightChoice>* out) const;
+    // Appends the count lights with the most importance to pos, and the unbounded lights, all weighted 1.
+    void TopK(const vec3& pos, int count, vector<LightChoice>* out) const;
+
+  private:
+    struct BuildLight {
+        Light* light;
+        vec3 position;
+        float power;
+    };
+
+    void Subdivide(vector<BuildLight>& build_lights, int node_i, int first, int count);
+};
+
+}  // namespace Raytracer
+
+#endif
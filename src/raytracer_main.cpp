@@ -1,27 +1,22 @@
 // Main templated from Dear ImGui
 #include "raytracer_main.h"
 
-inline float randf() {
-    return rand() / (float)RAND_MAX;
-}
-
 namespace Raytracer {
 
 // UI STATE
-int entity_count = 0;
-char scene_name[256] = "";
-char output_name[256] = "raytraced.bmp";
-vector<Material*> materials{new Material(&entity_count)};
-Camera* camera = new Camera(&entity_count);
-vector<Geometry*> shapes{};
-vector<Light*> lights{};
-vector<AmbientLight*> ambient_lights{};
 steady_clock::time_point last_request;
 bool update_automatically = false;
-vector<string> debug_log{};
+bool progressive = false;
+Accumulator accumulator;
+// Snapshot behind the full render in flight, if any.
+shared_ptr<SceneSnapshot> render_scene;
+// Renders write the back frame while the front one is on screen, then the two swap.
+Image* frames[2] = {NULL, NULL};
+int front_frame = 0;
 
 ImVec2 disp_img_size{0.0, 0.0};
 GLuint disp_img_tex = -1;
+GLuint disp_img_pbo = 0;
 
 ImVec2 operator - (ImVec2& lhs, ImVec2& rhs) {
     return ImVec2(lhs.x - rhs.x, lhs.y - rhs.y);
@@ -31,234 +26,35 @@ ImVec2 operator + (ImVec2& lhs, ImVec2& rhs) {
     return ImVec2(lhs.x + rhs.x, lhs.y + rhs.y);
 }
 
-vector<Geometry*>::iterator GetIter(Geometry* geo) {
-    for (vector<Geometry*>::iterator it = shapes.begin(); it < shapes.end(); it++) {
-        if ((*it)->id == geo->id) {
-            return it;
-        }
-    }
-    return shapes.end();
-}
-
-vector<Light*>::iterator GetIter(Light* light) {
-    for (vector<Light*>::iterator it = lights.begin(); it < lights.end(); it++) {
-        if ((*it)->id == light->id) {
-            return it;
-        }
-    }
-    return lights.end();
-}
-
-void Delete(Geometry* geo) {
-	shapes.erase(GetIter(geo));
-}
-
-void Delete(Light* light) {
-	lights.erase(GetIter(light));
-}
-
-
-void Reset() {
-    delete camera;
-    for (Geometry* o : shapes) {
-        delete o;
-    }
-    for (Light* o : lights) {
-        delete o;
-    }
-    for (Material* o : materials) {
-        delete o;
-    }
-    shapes.clear();
-    lights.clear();
-    ambient_lights.clear();
-    materials.clear();
-    load_state = LoadState{};
-
-    strcpy(output_name, "raytraced.bmp");
-
-    entity_count = 0;
-    materials.push_back(new Material(&entity_count));
-    camera = new Camera(&entity_count);
-}
-
-Color ApplyLighting(Ray ray, HitInformation hit_info) {
-    Color current(0, 0, 0);
-
-    for (Light* light : lights) {
-        if (light->Intensity(hit_info.pos) < Color(0.001, 0.001, 0.001))
-            continue;
-
-        Ray to_light = light->ReverseLightRay(hit_info.pos);
-        HitInformation light_intersection;
-        // If light is blocked
-        if (FindIntersection(shapes, to_light, &light_intersection) &&
-            light_intersection.dist < sqrt(light->DistanceTo2(hit_info.pos)))
-            continue;
-
-        Color diffuse = CalculateDiffuse(light, hit_info);
-        current = current + diffuse;
-
-        Color specular = CalculateSpecular(light, hit_info);
-        current = current + specular;
-    }
-    Ray reflected = Ray::Reflect(-hit_info.viewing, hit_info.pos, hit_info.normal, ray.bounces_left - 1);
-	reflected.last_material = hit_info.material;
-    Color refl_col =  hit_info.material->specular * EvaluateRay(reflected);
-    current = current + refl_col;
-
-
-    float next_ior = hit_info.material->ior;
-    Color t = hit_info.material->transmissive;
-    if (t.r + t.g + t.b > 0) {
-        Ray refracted = Ray::Refract(hit_info.viewing, hit_info.pos, hit_info.normal, next_ior, ray.bounces_left - 1);
-        refracted.last_material = hit_info.material;
-        if (refracted.bounces_left != -1)
-            current = current + hit_info.material->transmissive * EvaluateRay(refracted);
-    }
-
-    current = current + CalculateAmbient(hit_info);
-    IM_ASSERT(!isnan(current.r) && !isnan(current.g) && !isnan(current.b));
-    return current;
-}
-
-Color EvaluateRay(Ray ray) {
-    if (ray.bounces_left <= 0)
-        return camera->background_color;
-
-    HitInformation hit_info;
-    if (FindIntersection(shapes, ray, &hit_info)) {
-        return ApplyLighting(ray, hit_info);
-    } else {
-        return camera->background_color;
-    }
-}
-
-Color CalculateDiffuse(Light* light, HitInformation hit) {
-    Color il = light->Intensity(hit.pos);
-    vec3 to_light = light->ReverseLightRay(hit.pos).dir;
-    float amount = max(0, dot(hit.normal, to_light));
-    return hit.material->diffuse * il * amount;
-}
-
-Color CalculateSpecular(Light* light, HitInformation hit) {
-    vec3 to_light = light->ReverseLightRay(hit.pos).dir;
-    vec3 to_viewer = -hit.viewing;
-    Ray test = Ray::Reflect(to_light, hit.pos, hit.normal, -1);
-    float amount = pow(max(0, dot(test.dir, to_viewer)), hit.material->phong);
-
-    Color il = light->Intensity(hit.pos);
-
-    return hit.material->specular * il * amount;
-}
-
-Color CalculateAmbient(HitInformation hit) {
-    Color c = Color(0, 0, 0);
-
-    for (AmbientLight* al : ambient_lights) {
-        c = c + hit.material->ambient * al->color;
-    }
-
-    return c;
-}
-
-
-float PreRender() {
-    camera->PreRender();
-    for (Geometry* geo : shapes) geo->PreRender();
-    for (Light* light : lights) light->PreRender();
-    
-    for (Light* light : lights) {
-        light->UpdateMult();
-        AmbientLight* al = dynamic_cast<AmbientLight*>(light);
-        if (al != NULL) {
-            ambient_lights.push_back(al);
-        }
-    }
-
-    return camera->mid_res.y / tanf(camera->half_vfov * (M_PI / 180.0f));
-}
-
-void PostRender() {
-    ambient_lights.clear();
-
-    for (Light* light : lights) {
-        light->ClampColor();
-    }
+void RequestRender() {
+    last_request = chrono::steady_clock::now();
+    // A new render follows on its own in these modes, so the one in flight is stale.
+    if (progressive && accumulator.scene)
+        accumulator.scene->cancelled = true;
+    if (update_automatically && render_scene)
+        render_scene->cancelled = true;
 }
 
-void Render() {
-	float d = PreRender();
-    
-	Image outputImg = Image(camera->res.x, camera->res.y);
-#pragma omp parallel for num_threads(3) schedule(dynamic, camera->res.x)
-    for (int i = 0; i < camera->res.x * camera->res.y; i++) {
-        if (i == 0) Log(to_string(omp_get_num_threads()));
-        int x = i % camera->res.x;
-        int y = i / camera->res.x;
-        vector<ImVec2> offsets;
-#if SAMPLING == -1
-        offsets = {ImVec2(0.50, 0.50), ImVec2(0.15, 0.15), ImVec2(0.85, 0.15), ImVec2(0.85, 0.85), ImVec2(0.15, 0.85)};
-#elif SAMPLING == 0
-        offsets = {ImVec2(0.5, 0.5)};
-#else
-        for (int samp_i = 0; samp_i < SAMPLING; samp_i++)
-            offsets.push_back(ImVec2(randf(), randf()));
-#endif
-        Color col = Color(0, 0, 0);
-        for (ImVec2 offset : offsets) {
-            float u = camera->mid_res.x - x + offset.x;
-            float v = camera->mid_res.y - y + offset.y;
-
-            vec3 rayDir = (d * camera->forward + u * camera->right + v * camera->up).normalized();
-
-            Ray ray = Ray(camera->position, rayDir, camera->max_depth);
-            Color new_color = EvaluateRay(ray);
-            new_color.Clamp();
-            col = col + new_color * (1.0 / offsets.size());
-        }
-        outputImg.setPixel(x, y, col);
+// The frame to render into next, resized if needed.
+Image* BackFrame(const vec3i& res) {
+    Image*& back = frames[1 - front_frame];
+    if (back == NULL || back->width != res.x || back->height != res.y) {
+        delete back;
+        back = new Image(res.x, res.y);
     }
-
-	PostRender();
-
-    // TODO: Instead of displaying image, write to a buffer.
-    string relative_output_name = "output/" + string(output_name);
-    outputImg.write(relative_output_name.c_str());
-}
-
-void RenderOne() {
-    PreRender();
-
-    Color col = Color(0, 0, 0);
-    float u = camera->mid_res.x;
-    float v = camera->mid_res.y;
-
-    vec3 rayDir = camera->forward.normalized();
-
-    Ray ray = Ray(camera->position, rayDir, camera->max_depth);
-    Color new_color = EvaluateRay(ray);
-    new_color.Clamp();
-
-    PostRender();
+    return back;
 }
 
-void RequestRender() {
-    last_request = chrono::steady_clock::now();
+// Puts the finished back frame on screen.
+void PresentBackFrame() {
+    front_frame = 1 - front_frame;
+    DisplayImage(*frames[front_frame]);
 }
 
-bool FindIntersection(vector<Geometry*> geometry, Ray ray, HitInformation* intersection) {
-    HitInformation current_inter;
-    float dist = -1.0;
-    for (Geometry* geo : geometry) {
-        if (geo->FindIntersection(ray, &current_inter)) {
-            if (dist == -1.0 || current_inter.dist < dist) {
-                *intersection = current_inter;
-                dist = current_inter.dist;
-            }
-        }
-    }
-    return dist != -1.0;
+// Whether an async call has been started and hasn't finished yet. Never blocks.
+template <class T>
+bool Running(const future<T>& call) {
+    return call.valid() && call.wait_for(seconds(0)) != future_status::ready;
 }
 
 }  //  namespace Raytracer
@@ -266,8 +62,6 @@ bool FindIntersection(vector<Geometry*> geometry, Ray ray, HitInformation* inter
 using namespace Raytracer;
 
 // TODO: move more code out of main.
-// TODO: Changing program state shouldn't happen during a render call.
-// This can throw exceptions if we change something like image size during a render.
 // Main code
 int main(int argc, char** argv) {
     // Setup SDL
@@ -317,7 +111,8 @@ int main(int argc, char** argv) {
 
     // Our state
     ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
-    future<void> render_call;
+    future<bool> render_call;
+    future<bool> pass_call;
 
     // Main loop
     bool done = false;
@@ -362,10 +157,15 @@ int main(int argc, char** argv) {
         ImGui::Begin("Renderer Settings");
 
         duration<double> span = duration_cast<duration<double>>(steady_clock::now() - last_request);
-        bool time_update = update_automatically && (last_request != steady_clock::time_point() && span.count() > RENDER_DELAY);
+        bool time_update = !progressive && update_automatically && (last_request != steady_clock::time_point() && span.count() > RENDER_DELAY);
         if (ImGui::Button("Render", ImVec2(ImGui::GetWindowWidth() * 0.55, 0)) || time_update) {
-            last_request = steady_clock::time_point();
-            render_call = async(Render);
+            if (progressive) {
+                RequestRender();
+            } else if (!render_call.valid()) {
+                last_request = steady_clock::time_point();
+                render_scene = TakeSnapshot();
+                render_call = async(launch::async, RenderImage, ref(*render_scene), BackFrame(render_scene->camera.res));
+            }
         }
         ImGui::SameLine();
         if (ImGui::Button("RenderOne", ImVec2(ImGui::GetWindowWidth() * 0.20, 0))) {
@@ -373,17 +173,71 @@ int main(int argc, char** argv) {
         }
         ImGui::SameLine();
         ImGui::Checkbox("Auto", &update_automatically);
+        ImGui::SameLine();
+        if (ImGui::Checkbox("Progressive", &progressive)) {
+            if (progressive) {
+                RequestRender();
+            } else if (accumulator.scene) {
+                accumulator.scene->cancelled = true;
+                if (pass_call.valid()) pass_call.get();
+                accumulator.scene.reset();
+            }
+        }
+        if (progressive) {
+            ImGui::Text("Pass %d / %d", accumulator.passes, PassCount());
+        }
+        if (ImGui::Combo("Accelerator", &accelerator_type, accelerator_names, ACCEL_COUNT)) {
+            RequestRender();
+        }
+        ImGui::SliderInt("Threads", &render_threads, 1, HardwareThreads());
+        if (ImGui::Checkbox("Wavefront", &wavefront)) {
+            RequestRender();
+        }
+        static const char* light_selection_names[] = {"All", "Sampled", "Top K"};
+        if (ImGui::Combo("Lights", &light_selection, light_selection_names, 3)) {
+            RequestRender();
+        }
+        if (light_selection != LIGHTS_ALL && ImGui::SliderInt("Light Count", &light_count, 1, 64)) {
+            RequestRender();
+        }
+        static const char* sampling_names[] = {"Adaptive", "Five", "None", "Random"};
+        static const int sampling_modes[] = {AA_ADAPTIVE, AA_FIVE, AA_NONE, AA_RANDOM};
+        int sampling_i = sampling > 0 ? 3 : sampling - AA_ADAPTIVE;
+        if (ImGui::Combo("Sampling", &sampling_i, sampling_names, 4)) {
+            sampling = sampling_modes[sampling_i];
+            RequestRender();
+        }
+        if (sampling > 0 && ImGui::SliderInt("Samples", &sampling, 1, 64)) {
+            RequestRender();
+        }
+        if (sampling == AA_ADAPTIVE) {
+            if (ImGui::SliderInt("Max Samples", &adaptive_max_samples, 2, 256))
+                RequestRender();
+            if (ImGui::SliderFloat("Threshold", &adaptive_threshold, 0.001f, 0.2f, "%.3f"))
+                RequestRender();
+        }
 
         if (ImGui::Button("Save")) {
             Save();
         }
         ImGui::SameLine();
+        if (ImGui::Button("Save .p3b")) {
+            SaveBinary();
+        }
+        ImGui::SameLine();
         if (ImGui::Button("Load")) {
             Load();
+            UpdateCameraWidget();
+            RequestRender();
         }
         ImGui::SameLine();
         ImGui::InputTextWithHint("", "<scene filename>", scene_name, 256, ImGuiInputTextFlags_CharsNoBlank);
         ImGui::InputTextWithHint("Output Name", "output.png", output_name, 256, ImGuiInputTextFlags_CharsNoBlank);
+        ImGui::SameLine();
+        if (ImGui::Button("Save Image") && frames[front_frame] != NULL) {
+            string relative_output_name = "output/" + string(output_name);
+            frames[front_frame]->write(relative_output_name.c_str());
+        }
 
         ImGui::PushStyleColor(ImGuiCol_Text, ImVec4{0.7, 0.7, 1.0, 1.0});
         ImGui::PushStyleColor(ImGuiCol_TextDisabled, ImVec4{0.4, 0.4, 0.5, 1.0});
@@ -396,21 +250,20 @@ int main(int argc, char** argv) {
                 shape->ImGui();
             }
             if (ImGui::Button("New Sphere", ImVec2(ImGui::GetWindowWidth() / 3 - H_SPACING * 2, 0))) {
-                Material* mat = new Material(&entity_count);
-                materials.push_back(mat);
-                shapes.push_back(new Sphere(&entity_count, mat));
+                shapes.push_back(new Sphere(&entity_count, InternMaterial(Material(0))));
             }
 			ImGui::SameLine(0.0f, H_SPACING);
             if (ImGui::Button("New Triangle", ImVec2(ImGui::GetWindowWidth() / 3 - H_SPACING * 2, 0))) {
-                Material* mat = new Material(&entity_count);
-                materials.push_back(mat);
-                shapes.push_back(new Triangle(&entity_count, mat));
+                shapes.push_back(new Triangle(&entity_count, InternMaterial(Material(0))));
             }
 			ImGui::SameLine(0.0f, H_SPACING);
             if (ImGui::Button("New NormTriangle", ImVec2(ImGui::GetWindowWidth() / 3 - H_SPACING * 2, 0))) {
-                Material* mat = new Material(&entity_count);
-                materials.push_back(mat);
-                shapes.push_back(new NormalTriangle(&entity_count, mat));
+                shapes.push_back(new NormalTriangle(&entity_count, InternMaterial(Material(0))));
+            }
+            for (shared_ptr<Prototype>& prototype : prototypes) {
+                if (ImGui::Button(("Place " + prototype->name).c_str(), ImVec2(ImGui::GetWindowWidth() - H_SPACING * 2, 0))) {
+                    shapes.push_back(new Instance(&entity_count, prototype));
+                }
             }
         }
         ImGui::PopStyleColor();
@@ -443,11 +296,27 @@ int main(int argc, char** argv) {
         ImGui::End();
 
 
-        if (render_call.valid()) {
-            render_call.get();  // Calling get makes the render_call invalid, storing that we used it.
-            string relative_output_name = "output/" + string(output_name);
-            if (_access(relative_output_name.c_str(), 0) != -1)
-                DisplayImage(relative_output_name);
+        if (render_call.valid() && !Running(render_call)) {
+            // Calling get makes the render_call invalid, storing that we used it. Cancelled frames aren't shown.
+            if (render_call.get())
+                PresentBackFrame();
+            render_scene.reset();
+        }
+
+        // Progressive: one pass at a time, restarting whenever the scene changed since the last one.
+        // The next pass starts before the finished one is uploaded, so tracing and upload overlap.
+        if (progressive && !render_call.valid() && !Running(pass_call)) {
+            bool finished_pass = pass_call.valid() && pass_call.get();
+            if (finished_pass)
+                front_frame = 1 - front_frame;
+            if (last_request != steady_clock::time_point()) {
+                last_request = steady_clock::time_point();
+                RestartAccumulation(&accumulator);
+            }
+            if (accumulator.scene && accumulator.passes < PassCount())
+                pass_call = async(launch::async, RenderPass, &accumulator, BackFrame(accumulator.scene->camera.res));
+            if (finished_pass)
+                DisplayImage(*frames[front_frame]);
         }
 
         if (disp_img_tex != -1) {
@@ -483,6 +352,13 @@ int main(int argc, char** argv) {
         SDL_GL_SwapWindow(window);
     }
 
+    if (render_scene) render_scene->cancelled = true;
+    if (accumulator.scene) accumulator.scene->cancelled = true;
+    if (render_call.valid()) render_call.get();
+    if (pass_call.valid()) pass_call.get();
+    delete frames[0];
+    delete frames[1];
+
     delete camera;
     for (Geometry* geo : shapes) {
         delete geo;
@@ -0,0 +1,90 @@
+#include "raytracer_mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Raytracer {
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const string& path) {
+    Close();
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        file = NULL;
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        Close();
+        return false;
+    }
+    size = (size_t)file_size.QuadPart;
+    if (size == 0)
+        return true;
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping != NULL)
+        data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == NULL) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data != NULL) UnmapViewOfFile(data);
+    if (mapping != NULL) CloseHandle(mapping);
+    if (file != NULL) CloseHandle(file);
+    data = NULL;
+    mapping = NULL;
+    file = NULL;
+    size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const string& path) {
+    Close();
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        Close();
+        return false;
+    }
+    size = info.st_size;
+    if (size == 0)
+        return true;
+
+    void* view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    madvise(view, size, MADV_SEQUENTIAL);
+    data = (const char*)view;
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data != NULL) munmap((void*)data, size);
+    if (fd != -1) close(fd);
+    data = NULL;
+    fd = -1;
+    size = 0;
+}
+
+#endif
+
+}  // namespace Raytracer
@@ -0,0 +1,35 @@
+#ifndef _RAYTRACER_MAPPED_FILE_H
+#define _RAYTRACER_MAPPED_FILE_H
+
+#include <stddef.h>
+#include <string>
+
+using namespace std;
+
+namespace Raytracer {
+
+// Read-only view of a whole file through the OS page cache, so loading a scene doesn't copy it.
+struct MappedFile {
+    const char* data = NULL;
+    size_t size = 0;
+
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    ~MappedFile() { Close(); }
+
+    // Returns false if the file can't be opened. An empty file opens with data NULL and size 0.
+    bool Open(const string& path);
+    void Close();
+
+  private:
+#ifdef _WIN32
+    void* file = NULL;
+    void* mapping = NULL;
+#else
+    int fd = -1;
+#endif
+};
+
+}  // namespace Raytracer
+
+#endif
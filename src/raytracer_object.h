@@ -2,11 +2,14 @@
 #define _RAYTRACER_OBJECT_H
 
 #include <string>
+#include "raytracer_parse.h"
 
 using namespace std;
 
 namespace Raytracer {
 
+struct SceneWriter;
+
 // Non-enforced abstract class for raytracer objects. These are both UI objects,
 // and entities.
 struct Object {
@@ -16,11 +19,13 @@ struct Object {
     Object(int* entity_count);
     // Call with id to replace
     Object(int old_id);
+    virtual ~Object() {}
 
     virtual void ImGui() {}
-	// String representation for saving.
-    virtual string Encode() { return ""; }
-    virtual void Decode(string& s) {}
+	// Writes the object's lines of a scene file.
+    virtual void Encode(SceneWriter& out) {}
+    // Reads the value of a scene file line, after its key.
+    virtual void Decode(FieldReader& in) {}
 	// Called once right before rendering, allows objects to finalize intermediate data
 	virtual void PreRender() {}
 
@@ -0,0 +1,25 @@
+#include "raytracer_packet.h"
+
+namespace Raytracer {
+
+void RayPacket::Prepare() {
+    for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+        if (!(active & (1 << lane))) {
+            // Never read through the mask, only kept finite.
+            for (int axis = 0; axis < 3; axis++) {
+                pos[axis][lane] = 0;
+                inv_dir[axis][lane] = 1;
+            }
+            continue;
+        }
+        const Ray& ray = rays[lane];
+        pos[0][lane] = ray.pos.x;
+        pos[1][lane] = ray.pos.y;
+        pos[2][lane] = ray.pos.z;
+        inv_dir[0][lane] = 1.0 / ray.dir.x;
+        inv_dir[1][lane] = 1.0 / ray.dir.y;
+        inv_dir[2][lane] = 1.0 / ray.dir.z;
+    }
+}
+
+}  // namespace Raytracer
@@ -0,0 +1,37 @@
+#ifndef _RAYTRACER_PACKET_H
+#define _RAYTRACER_PACKET_H
+
+#include "raytracer_ray.h"
+#include "raytracer_simd.h"
+
+// Pixel block covered by one packet of camera rays, one lane per pixel.
+#if SIMD_WIDTH == 8
+#define PACKET_W 4
+#define PACKET_H 2
+#elif SIMD_WIDTH == 4
+#define PACKET_W 2
+#define PACKET_H 2
+#else
+#define PACKET_W 1
+#define PACKET_H 1
+#endif
+
+namespace Raytracer {
+
+// Coherent rays traced through the accelerator together. Camera rays are packed, and so are reflected and
+// refracted rays once the wavefront path has sorted them. Unsorted they diverge too quickly and stay scalar,
+// as do shadow rays.
+struct RayPacket {
+    Ray rays[SIMD_WIDTH];
+    // One bit per lane holding a ray. Lanes past the edge of the image are left off.
+    int active = 0;
+    // Single precision copies of the rays for the wide box tests, filled by Prepare().
+    SIMD_ALIGN float pos[3][SIMD_WIDTH];
+    SIMD_ALIGN float inv_dir[3][SIMD_WIDTH];
+
+    void Prepare();
+};
+
+}  // namespace Raytracer
+
+#endif
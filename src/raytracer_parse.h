@@ -0,0 +1,99 @@
+#ifndef _RAYTRACER_PARSE_H
+#define _RAYTRACER_PARSE_H
+
+#include <charconv>
+#include <ctype.h>
+#include <string.h>
+#include <string>
+#include <system_error>
+
+using namespace std;
+
+namespace Raytracer {
+
+// Reads whitespace separated values from a scene file line with std::from_chars, without copying it.
+// Behaves like extracting from a stringstream: a value that can't be read is set to zero, and every
+// read after it leaves its value untouched.
+struct FieldReader {
+    const char* p;
+    const char* end;
+    bool ok = true;
+
+    FieldReader(const char* begin, const char* end) : p(begin), end(end) {}
+    FieldReader(const string& s) : p(s.data()), end(s.data() + s.size()) {}
+
+    void SkipSpace() {
+        while (p < end && isspace((unsigned char)*p)) p++;
+    }
+
+    template <class T>
+    FieldReader& operator>>(T& value) {
+        if (!ok)
+            return *this;
+        SkipSpace();
+        // from_chars doesn't take the leading '+' that streams accept.
+        const char* start = (p < end && *p == '+') ? p + 1 : p;
+        from_chars_result result = from_chars(start, end, value);
+        if (result.ec != errc()) {
+            value = T();
+            ok = false;
+            return *this;
+        }
+        p = result.ptr;
+        return *this;
+    }
+
+    // Reads one word into a buffer of CHARARRAY_LEN characters, like streaming into a char array.
+    void ReadWord(char* out, size_t capacity) {
+        if (!ok)
+            return;
+        SkipSpace();
+        size_t len = 0;
+        while (p < end && !isspace((unsigned char)*p)) {
+            if (len + 1 < capacity) out[len++] = *p;
+            p++;
+        }
+        if (len == 0) {
+            ok = false;
+            return;
+        }
+        out[len] = '\0';
+    }
+};
+
+// Keys a scene file line can start with, always followed by ": ".
+enum SceneKey {
+    KEY_NONE,
+    KEY_CAMERA_POS,
+    KEY_CAMERA_FWD,
+    KEY_CAMERA_UP,
+    KEY_CAMERA_FOV_HA,
+    KEY_FILM_RESOLUTION,
+    KEY_OUTPUT_IMAGE,
+    KEY_BACKGROUND,
+    KEY_MAX_DEPTH,
+    KEY_MAX_VERTICES,
+    KEY_MAX_NORMALS,
+    KEY_VERTEX,
+    KEY_NORMAL,
+    KEY_SPHERE,
+    KEY_SPHERE_CLOUD,
+    KEY_TRIANGLE,
+    KEY_NORMAL_TRIANGLE,
+    KEY_MATERIAL,
+    KEY_AMBIENT_LIGHT,
+    KEY_DIRECTIONAL_LIGHT,
+    KEY_POINT_LIGHT,
+    KEY_SPOT_LIGHT,
+    KEY_OBJECT,
+    KEY_END_OBJECT,
+    KEY_INSTANCE
+};
+
+// The key of the line [begin, end), with *rest set to the value after ": ". KEY_NONE for comments,
+// blank lines, unknown keys and keys with nothing after them, which the loader has always skipped.
+SceneKey FindSceneKey(const char* begin, const char* end, const char** rest);
+
+}  // namespace Raytracer
+
+#endif
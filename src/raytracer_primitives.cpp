@@ -0,0 +1,207 @@
+#include "raytracer_primitives.h"
+
+namespace Raytracer {
+
+// Slack on the float sphere block test, relative to the squared distances involved. Candidates it lets
+// through are confirmed by the exact SphereRecord test.
+#define SPHERE_BLOCK_EPSILON 2e-6f
+
+void PrimitiveArrays::Clear() {
+    *this = PrimitiveArrays{};
+}
+
+void PrimitiveArrays::Finish() {
+    first[PRIM_SPHERE] = 0;
+    first[PRIM_SPHERE_BLOCK] = spheres.size();
+    first[PRIM_TRIANGLE] = first[PRIM_SPHERE_BLOCK] + sphere_blocks.size();
+    first[PRIM_NORMAL_TRIANGLE] = first[PRIM_TRIANGLE] + triangles.size();
+    first[PRIM_TYPES] = first[PRIM_NORMAL_TRIANGLE] + normal_triangles.size();
+}
+
+BoundingBox PrimitiveArrays::Bounds(uint32_t prim) const {
+    if (prim < first[PRIM_SPHERE_BLOCK])
+        return spheres[prim].Bounds();
+    if (prim < first[PRIM_TRIANGLE]) {
+        uint32_t block = prim - first[PRIM_SPHERE_BLOCK];
+        BoundingBox bounds = BoundingBox::Empty();
+        for (int lane = 0; lane < sphere_blocks[block].count; lane++) {
+            bounds.Extend(sphere_block_spheres[block * SIMD_WIDTH + lane].Bounds());
+        }
+        return bounds;
+    }
+    if (prim < first[PRIM_NORMAL_TRIANGLE]) {
+        const vec3* corners = &triangle_corners[3 * (prim - first[PRIM_TRIANGLE])];
+        return TriangleBounds(corners[0], corners[1], corners[2]);
+    }
+    const vec3* corners = &normal_triangle_corners[3 * (prim - first[PRIM_NORMAL_TRIANGLE])];
+    return TriangleBounds(corners[0], corners[1], corners[2]);
+}
+
+uint16_t PrimitiveArrays::MaterialIndex(Material* material) {
+    auto found = material_index.find(material);
+    if (found != material_index.end())
+        return found->second;
+    if (materials.size() >= PRIM_MAX_MATERIALS) {
+        materials_overflowed = true;
+        return 0;
+    }
+    uint16_t index = materials.size();
+    materials.push_back(material);
+    material_index[material] = index;
+    return index;
+}
+
+void PrimitiveArrays::AddSphereBlock(const SphereRecord* block_spheres, int count, uint16_t material) {
+    BoundingBox bounds = BoundingBox::Empty();
+    for (int i = 0; i < count; i++) {
+        bounds.Extend(block_spheres[i].Bounds());
+    }
+
+    SphereBlock block{};
+    block.origin = bounds.Centroid();
+    block.count = count;
+    for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+        if (lane < count) {
+            vec3 center = block_spheres[lane].position - block.origin;
+            block.center[0][lane] = center.x;
+            block.center[1][lane] = center.y;
+            block.center[2][lane] = center.z;
+            block.radius[lane] = block_spheres[lane].radius;
+            block.reach2 = fmax(block.reach2, (float)center.mag2());
+            sphere_block_spheres.push_back(block_spheres[lane]);
+        } else {
+            sphere_block_spheres.push_back(SphereRecord{});
+        }
+    }
+    sphere_blocks.push_back(block);
+    sphere_block_materials.push_back(material);
+}
+
+// Lanes of block whose sphere the ray may reach before t_max. The same quadratic as SphereRecord::Intersect(),
+// with the discriminant widened by the rounding floats can add to it, so no sphere the exact test would hit is missed.
+static int SphereBlockCandidates(const SphereBlock& block, const Ray& ray, float t_max) {
+    vec3 rel = ray.pos - block.origin;
+    vfloat pos[3] = {(float)rel.x, (float)rel.y, (float)rel.z};
+    vfloat dir[3] = {(float)ray.dir.x, (float)ray.dir.y, (float)ray.dir.z};
+
+    vfloat to_center[3];
+    for (int axis = 0; axis < 3; axis++) {
+        to_center[axis] = vfloat::Load(block.center[axis]) - pos[axis];
+    }
+    vfloat b = to_center[0] * dir[0] + to_center[1] * dir[1] + to_center[2] * dir[2];
+    vfloat dist2 = to_center[0] * to_center[0] + to_center[1] * to_center[1] + to_center[2] * to_center[2];
+    vfloat radius = vfloat::Load(block.radius);
+    vfloat slack = vfloat(SPHERE_BLOCK_EPSILON) * (dist2 + vfloat(block.reach2 + (float)rel.mag2()));
+    vfloat discr = b * b - dist2 + radius * radius + slack;
+
+    vfloat zero(0.0f);
+    vfloat root = vsqrt(vmax(discr, zero));
+    vfloat hit = (discr >= zero) & (b + root >= zero) & (b - root <= vfloat(t_max));
+    return hit.Bits() & ((1 << block.count) - 1);
+}
+
+bool PrimitiveArrays::Intersect(uint32_t prim, const Ray& ray, PrimitiveHit* hit) const {
+    hit->prim = prim;
+    if (prim < first[PRIM_SPHERE_BLOCK])
+        return spheres[prim].Intersect(ray, &hit->t);
+    if (prim < first[PRIM_TRIANGLE]) {
+        uint32_t block = prim - first[PRIM_SPHERE_BLOCK];
+        int mask = SphereBlockCandidates(sphere_blocks[block], ray, INFINITY);
+        bool found = false;
+        float t;
+        for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+            if ((mask & 1) && sphere_block_spheres[block * SIMD_WIDTH + lane].Intersect(ray, &t) && (!found || t < hit->t)) {
+                hit->t = t;
+                hit->lane = lane;
+                found = true;
+            }
+        }
+        return found;
+    }
+    if (prim < first[PRIM_NORMAL_TRIANGLE])
+        return triangles[prim - first[PRIM_TRIANGLE]].Intersect(ray, &hit->t, &hit->u, &hit->v);
+    return normal_triangles[prim - first[PRIM_NORMAL_TRIANGLE]].Intersect(ray, &hit->t, &hit->u, &hit->v);
+}
+
+void PrimitiveArrays::Resolve(const Ray& ray, const PrimitiveHit& hit, HitInformation* intersection) const {
+    uint32_t prim = hit.prim;
+    float t = hit.t;
+    if (prim < first[PRIM_TRIANGLE]) {
+        const SphereRecord* sphere;
+        Material* material;
+        if (prim < first[PRIM_SPHERE_BLOCK]) {
+            sphere = &spheres[prim];
+            material = materials[sphere_materials[prim]];
+        } else {
+            uint32_t block = prim - first[PRIM_SPHERE_BLOCK];
+            sphere = &sphere_block_spheres[block * SIMD_WIDTH + hit.lane];
+            material = materials[sphere_block_materials[block]];
+        }
+        vec3 hit_pos = ray.pos + t * ray.dir;
+        vec3 hit_norm = (hit_pos - sphere->position).normalized();
+        *intersection = HitInformation{t, hit_pos, ray.dir, hit_norm, material};
+        return;
+    }
+
+    if (prim < first[PRIM_NORMAL_TRIANGLE]) {
+        uint32_t i = prim - first[PRIM_TRIANGLE];
+        const TriangleRecord& record = triangles[i];
+        intersection->normal = dot(ray.dir, record.normal) < 0 ? record.normal : -record.normal;
+        intersection->material = materials[triangle_materials[i]];
+    } else {
+        uint32_t i = prim - first[PRIM_NORMAL_TRIANGLE];
+        const vec3* n = normals[i].n;
+        intersection->normal = n[0] * (1 - hit.u - hit.v) + n[1] * hit.u + n[2] * hit.v;
+        intersection->material = materials[normal_triangle_materials[i]];
+    }
+    intersection->dist = t;
+    intersection->pos = ray.pos + ray.dir * t;
+    intersection->viewing = ray.dir;
+}
+
+bool PrimitiveArrays::Occluded(uint32_t prim, const Ray& ray, float t_max) const {
+    float t, u, v;
+    if (prim < first[PRIM_SPHERE_BLOCK])
+        return spheres[prim].Intersect(ray, &t) && t < t_max;
+    if (prim < first[PRIM_TRIANGLE]) {
+        uint32_t block = prim - first[PRIM_SPHERE_BLOCK];
+        int mask = SphereBlockCandidates(sphere_blocks[block], ray, t_max);
+        for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+            if ((mask & 1) && sphere_block_spheres[block * SIMD_WIDTH + lane].Intersect(ray, &t) && t < t_max)
+                return true;
+        }
+        return false;
+    }
+    if (prim < first[PRIM_NORMAL_TRIANGLE])
+        return triangles[prim - first[PRIM_TRIANGLE]].Intersect(ray, &t, &u, &v) && t < t_max;
+    return normal_triangles[prim - first[PRIM_NORMAL_TRIANGLE]].Intersect(ray, &t, &u, &v) && t < t_max;
+}
+
+bool PrimitiveArrays::OverlapsCube(uint32_t prim, vec3 pos, float hwidth) const {
+    if (prim < first[PRIM_SPHERE_BLOCK])
+        return spheres[prim].OverlapsCube(pos, hwidth);
+    if (prim < first[PRIM_TRIANGLE]) {
+        uint32_t block = prim - first[PRIM_SPHERE_BLOCK];
+        for (int lane = 0; lane < sphere_blocks[block].count; lane++) {
+            if (sphere_block_spheres[block * SIMD_WIDTH + lane].OverlapsCube(pos, hwidth))
+                return true;
+        }
+        return false;
+    }
+    if (prim < first[PRIM_NORMAL_TRIANGLE]) {
+        const vec3* corners = &triangle_corners[3 * (prim - first[PRIM_TRIANGLE])];
+        return TriangleOverlapsCube(corners[0], corners[1], corners[2], pos, hwidth);
+    }
+    const vec3* corners = &normal_triangle_corners[3 * (prim - first[PRIM_NORMAL_TRIANGLE])];
+    return TriangleOverlapsCube(corners[0], corners[1], corners[2], pos, hwidth);
+}
+
+const TriangleRecord* PrimitiveArrays::Triangle(uint32_t prim) const {
+    if (prim < first[PRIM_TRIANGLE])
+        return NULL;
+    if (prim < first[PRIM_NORMAL_TRIANGLE])
+        return &triangles[prim - first[PRIM_TRIANGLE]];
+    return &normal_triangles[prim - first[PRIM_NORMAL_TRIANGLE]];
+}
+
+}  // namespace Raytracer
@@ -0,0 +1,112 @@
+#ifndef _RAYTRACER_PRIMITIVES_H
+#define _RAYTRACER_PRIMITIVES_H
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+#include <vec3.h>
+#include "raytracer_geometry.h"
+#include "raytracer_simd.h"
+
+using namespace std;
+
+namespace Raytracer {
+
+enum PrimitiveType {
+    PRIM_SPHERE,
+    PRIM_SPHERE_BLOCK,
+    PRIM_TRIANGLE,
+    PRIM_NORMAL_TRIANGLE,
+    PRIM_TYPES
+};
+
+// Corner normals of a smooth triangle, interpolated with the barycentric weights of the hit.
+struct TriangleNormals {
+    vec3 n[3];
+};
+
+// Up to SIMD_WIDTH neighboring spheres of a SphereCloud, stored as structure of arrays so one ray is tested
+// against all of them at once. Centers are kept relative to origin, so they keep their float precision
+// wherever the cloud is.
+struct SIMD_ALIGN SphereBlock {
+    SIMD_ALIGN float center[3][SIMD_WIDTH];
+    SIMD_ALIGN float radius[SIMD_WIDTH];
+    vec3 origin;
+    // Largest squared distance of a center from origin, part of the slack of the float test.
+    float reach2;
+    int count;
+};
+
+// Most materials a snapshot's primitives can use, as they refer to them by 16 bit index.
+#define PRIM_MAX_MATERIALS 65536
+
+// What an accelerator keeps of the closest hit so far: enough to rebuild the rest with Resolve() once the
+// closest one is known, instead of working out the point, normal and material of every hit on the way there.
+struct PrimitiveHit {
+    float t;
+    // Barycentric weights of corners 1 and 2 for triangles, unused for spheres.
+    float u, v;
+    uint32_t prim;
+    // Which sphere of a sphere block was hit.
+    int lane;
+};
+
+// Every primitive of a snapshot, compiled from its shapes in PreRender(). The editor's Geometry objects are
+// scattered over the heap and reached through virtual calls; here each kind of primitive has its own
+// contiguous arrays, and a primitive is just an index into them. Indices run over the spheres, then the flat
+// triangles, then the smooth ones, so an accelerator leaf tells them apart by comparing against first[],
+// and meshes are split into triangles of whichever kind they are made of. Sphere clouds come in sphere blocks,
+// primitives holding up to SIMD_WIDTH spheres each, between the lone spheres and the flat triangles.
+//
+// The records the intersection loops read are kept apart from materials and corners, which are only read for
+// the closest hit or while building accelerators. Materials are stored once in a table and each primitive keeps
+// a 16 bit index into it, so hits can also be grouped by material.
+struct PrimitiveArrays {
+    vector<SphereRecord> spheres;
+    vector<SphereBlock> sphere_blocks;
+    vector<TriangleRecord> triangles;
+    vector<TriangleRecord> normal_triangles;
+    vector<TriangleNormals> normals;
+
+    vector<Material*> materials;
+    vector<uint16_t> sphere_materials;
+    vector<uint16_t> sphere_block_materials;
+    vector<uint16_t> triangle_materials;
+    vector<uint16_t> normal_triangle_materials;
+    // SIMD_WIDTH per sphere block, the exact spheres the float test of the block is confirmed with.
+    vector<SphereRecord> sphere_block_spheres;
+    // Three per triangle, exactly as the shape had them, so bounds don't pick up rounding from the records.
+    vector<vec3> triangle_corners;
+    vector<vec3> normal_triangle_corners;
+
+    // Index of the first primitive of each type. first[PRIM_TYPES] is the primitive count.
+    uint32_t first[PRIM_TYPES + 1] = {};
+    // Set when more than PRIM_MAX_MATERIALS materials were asked for, the rest share the first one.
+    bool materials_overflowed = false;
+
+    void Clear();
+    // Numbers the primitives once every shape has appended its own.
+    void Finish();
+    uint32_t Count() const { return first[PRIM_TYPES]; }
+    // Index of material in the table, adding it on first use.
+    uint16_t MaterialIndex(Material* material);
+    // Packs count <= SIMD_WIDTH spheres into a new sphere block.
+    void AddSphereBlock(const SphereRecord* block_spheres, int count, uint16_t material);
+
+    BoundingBox Bounds(uint32_t prim) const;
+    // Tests prim without working out anything but where it was hit.
+    bool Intersect(uint32_t prim, const Ray& ray, PrimitiveHit* hit) const;
+    // The full hit information of a hit found with Intersect(), only worth working out for the closest one.
+    void Resolve(const Ray& ray, const PrimitiveHit& hit, HitInformation* intersection) const;
+    bool Occluded(uint32_t prim, const Ray& ray, float t_max) const;
+    bool OverlapsCube(uint32_t prim, vec3 pos, float hwidth) const;
+    // The triangle behind a primitive, NULL for spheres.
+    const TriangleRecord* Triangle(uint32_t prim) const;
+
+  private:
+    unordered_map<const Material*, uint16_t> material_index;
+};
+
+}  // namespace Raytracer
+
+#endif
@@ -2,6 +2,11 @@
 
 namespace Raytracer {
 
+bool Material::Matches(const Material& other) const {
+    return ambient == other.ambient && diffuse == other.diffuse && specular == other.specular &&
+           transmissive == other.transmissive && phong == other.phong && ior == other.ior;
+}
+
 Ray Ray::Reflect(vec3 dir_in, vec3 origin, vec3 dir_mirror, int bounces_left) {
 
     vec3 midpoint = dir_mirror * dot(dir_in, dir_mirror);
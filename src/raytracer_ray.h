@@ -17,9 +17,14 @@ struct Material : Object {
 
     using Object::Object;
 
+#ifndef RAYTRACER_HEADLESS
     void ImGui();
-    string Encode();
-    void Decode(string& s);
+#endif
+    void Encode(SceneWriter& out);
+    void Decode(FieldReader& in);
+
+    // Same parameters, regardless of id.
+    bool Matches(const Material& other) const;
 };
 
 struct Ray {
@@ -28,6 +33,7 @@ struct Ray {
     int bounces_left;
 	Material* last_material = NULL;
 
+    Ray() : bounces_left(0) {}
     Ray(vec3 p, vec3 d, int b) : pos(p), dir(d.normalized()), bounces_left(b) {}
     static Ray Reflect(vec3 ang, vec3 pos, vec3 norm, int bounces_left);
 	static Ray Refract(vec3 dir_in, vec3 origin, vec3 norm, float iornew, int bounces_left);
@@ -0,0 +1,774 @@
+#include "raytracer_render.h"
+
+#include <algorithm>
+#include <cassert>
+#include <string.h>
+#include <unordered_map>
+#include <unordered_set>
+#include "raytracer_sampler.h"
+
+namespace Raytracer {
+
+// SCENE STATE
+int entity_count = 0;
+char scene_name[256] = "";
+char output_name[256] = "raytraced.bmp";
+vector<Material*> materials{new Material(&entity_count)};
+Camera* camera = new Camera(&entity_count);
+vector<Geometry*> shapes{};
+vector<Light*> lights{};
+vector<shared_ptr<Prototype>> prototypes{};
+vector<string> debug_log{};
+mutex debug_log_lock;
+int accelerator_type = ACCEL_BVH;
+int sampling = SAMPLING;
+int adaptive_max_samples = ADAPTIVE_MAX_SAMPLES;
+float adaptive_threshold = ADAPTIVE_THRESHOLD;
+int render_threads = RENDER_THREADS > 0 ? RENDER_THREADS : HardwareThreads();
+int light_selection = LIGHT_SELECTION;
+int light_count = LIGHT_COUNT;
+bool wavefront = WAVEFRONT;
+TileScheduler tile_scheduler;
+#if PACKET_VALIDATE
+atomic<int> packet_mismatches{0};
+#endif
+// Rays traced by this thread since it last added them to ray_total, which is summed over a render.
+thread_local long long rays_traced = 0;
+atomic<long long> ray_total{0};
+
+vector<Geometry*>::iterator GetIter(Geometry* geo) {
+    for (vector<Geometry*>::iterator it = shapes.begin(); it < shapes.end(); it++) {
+        if ((*it)->id == geo->id) {
+            return it;
+        }
+    }
+    return shapes.end();
+}
+
+vector<Light*>::iterator GetIter(Light* light) {
+    for (vector<Light*>::iterator it = lights.begin(); it < lights.end(); it++) {
+        if ((*it)->id == light->id) {
+            return it;
+        }
+    }
+    return lights.end();
+}
+
+void Delete(Geometry* geo) {
+	shapes.erase(GetIter(geo));
+}
+
+void Delete(Light* light) {
+	lights.erase(GetIter(light));
+}
+
+
+void Reset() {
+    delete camera;
+    for (Geometry* o : shapes) {
+        delete o;
+    }
+    for (Light* o : lights) {
+        delete o;
+    }
+    for (Material* o : materials) {
+        delete o;
+    }
+    shapes.clear();
+    lights.clear();
+    materials.clear();
+    prototypes.clear();
+    load_state = LoadState{};
+
+    strcpy(output_name, "raytraced.bmp");
+
+    entity_count = 0;
+    materials.push_back(new Material(&entity_count));
+    camera = new Camera(&entity_count);
+}
+
+Material* InternMaterial(const Material& mat) {
+    // Scenes repeat the material they used last, so look from the back.
+    for (auto it = materials.rbegin(); it != materials.rend(); ++it) {
+        if ((*it)->Matches(mat))
+            return *it;
+    }
+    Material* interned = new Material(&entity_count);
+    int id = interned->id;
+    *interned = mat;
+    interned->id = id;
+    materials.push_back(interned);
+    return interned;
+}
+
+void PruneMaterials() {
+    unordered_set<Material*> used;
+    for (Geometry* geo : shapes) used.insert(geo->material);
+    auto unused = remove_if(materials.begin() + 1, materials.end(), [&used](Material* mat) {
+        if (used.count(mat))
+            return false;
+        delete mat;
+        return true;
+    });
+    materials.erase(unused, materials.end());
+}
+
+// Diffuse and specular light from every light that can see the hit.
+static Color DirectLighting(const SceneSnapshot& scene, const HitInformation& hit_info) {
+    Color current(0, 0, 0);
+
+    for (const LightChoice& choice : SelectLights(scene, hit_info)) {
+        Light* light = choice.light;
+        if (light->Intensity(hit_info.pos) < Color(0.001, 0.001, 0.001))
+            continue;
+
+        Ray to_light = light->ReverseLightRay(hit_info.pos);
+        // If light is blocked
+        if (Occluded(scene, to_light, sqrt(light->DistanceTo2(hit_info.pos))))
+            continue;
+
+        Color diffuse = CalculateDiffuse(light, hit_info);
+        current = current + diffuse * choice.weight;
+
+        Color specular = CalculateSpecular(light, hit_info);
+        current = current + specular * choice.weight;
+    }
+    return current;
+}
+
+// A hit whose color is being added up while its reflected and refracted rays are traced.
+struct PathFrame {
+    HitInformation hit;
+    int bounces_left;
+    // Product of the reflection and transmission weights from the camera to this hit.
+    Color throughput;
+    Color current;
+    // What the frame does next: 0 reflects, 1 adds the reflection and refracts, 2 adds the refraction,
+    // 3 adds ambient light and hands current to the frame below.
+    int stage;
+};
+
+// Each render thread evaluates one path at a time, so one stack per thread is enough.
+thread_local PathFrame path_stack[MAX_PATH_DEPTH];
+
+// The color of a ray that hit hit_info. Walks the tree of reflected and refracted rays with path_stack
+// instead of recursing, adding every term in the same order the recursive version did, so the result is the
+// same to the bit. Subtrees whose throughput is zero are never traced, as they can't change the sum.
+Color ApplyLighting(const SceneSnapshot& scene, const Ray& ray, const HitInformation& hit_info) {
+    int top = 0;
+    PathFrame* frame = &path_stack[0];
+    frame->hit = hit_info;
+    frame->bounces_left = ray.bounces_left;
+    frame->throughput = Color(1, 1, 1);
+    frame->current = DirectLighting(scene, hit_info);
+    frame->stage = 0;
+
+    // Color of the last ray that finished, waiting to be added to the frame that spawned it.
+    Color result;
+    // Starts a child ray of frame weighted by weight. Pushes a frame and returns true if it hit something,
+    // otherwise sets result to what the ray sees.
+    auto spawn = [&](const Ray& child, const Color& weight) {
+        Color throughput = frame->throughput * weight;
+        if (throughput.r == 0 && throughput.g == 0 && throughput.b == 0) {
+            result = Color(0, 0, 0);
+            return false;
+        }
+        HitInformation child_hit;
+        if (child.bounces_left <= 0 || top + 1 == MAX_PATH_DEPTH || !FindIntersection(scene, child, &child_hit)) {
+            result = scene.camera.background_color;
+            return false;
+        }
+        frame = &path_stack[++top];
+        frame->hit = child_hit;
+        frame->bounces_left = child.bounces_left;
+        frame->throughput = throughput;
+        frame->current = DirectLighting(scene, child_hit);
+        frame->stage = 0;
+        return true;
+    };
+
+    while (true) {
+        const Material* material = frame->hit.material;
+        switch (frame->stage) {
+            case 0: {
+                frame->stage = 1;
+                Ray reflected = Ray::Reflect(-frame->hit.viewing, frame->hit.pos, frame->hit.normal, frame->bounces_left - 1);
+                reflected.last_material = frame->hit.material;
+                spawn(reflected, material->specular);
+                break;
+            }
+            case 1: {
+                frame->current = frame->current + material->specular * result;
+                frame->stage = 3;
+                Color t = material->transmissive;
+                if (t.r + t.g + t.b > 0) {
+                    Ray refracted = Ray::Refract(frame->hit.viewing, frame->hit.pos, frame->hit.normal, material->ior, frame->bounces_left - 1);
+                    refracted.last_material = frame->hit.material;
+                    if (refracted.bounces_left != -1) {
+                        frame->stage = 2;
+                        spawn(refracted, t);
+                    }
+                }
+                break;
+            }
+            case 2:
+                frame->current = frame->current + material->transmissive * result;
+                frame->stage = 3;
+                break;
+            case 3:
+                frame->current = frame->current + CalculateAmbient(scene, frame->hit);
+                assert(!isnan(frame->current.r) && !isnan(frame->current.g) && !isnan(frame->current.b));
+                result = frame->current;
+                if (top == 0)
+                    return result;
+                frame = &path_stack[--top];
+                break;
+        }
+    }
+}
+
+Color EvaluateRay(const SceneSnapshot& scene, Ray ray) {
+    if (ray.bounces_left <= 0)
+        return scene.camera.background_color;
+
+    HitInformation hit_info;
+    if (FindIntersection(scene, ray, &hit_info)) {
+        return ApplyLighting(scene, ray, hit_info);
+    } else {
+        return scene.camera.background_color;
+    }
+}
+
+void EvaluatePacket(const SceneSnapshot& scene, const RayPacket& packet, Color* colors) {
+    HitInformation hits[SIMD_WIDTH];
+    // Camera rays all start with the same bounce count.
+    int hit_mask = scene.camera.max_depth > 0 ? FindIntersection(scene, packet, hits) : 0;
+    for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+        int bit = 1 << lane;
+        if (!(packet.active & bit))
+            continue;
+#if PACKET_VALIDATE
+        HitInformation scalar_hit;
+        bool scalar = scene.camera.max_depth > 0 && FindIntersection(scene, packet.rays[lane], &scalar_hit);
+        if (scalar != ((hit_mask & bit) != 0) || (scalar && scalar_hit.dist != hits[lane].dist))
+            packet_mismatches++;
+#endif
+        if (hit_mask & bit)
+            colors[lane] = ApplyLighting(scene, packet.rays[lane], hits[lane]);
+        else
+            colors[lane] = scene.camera.background_color;
+    }
+}
+
+// Seed of the lights sampled at a hit. No two hits are in quite the same place, so their positions make for
+// streams that are as good as random and still the same from one render to the next.
+static uint64_t HitSeed(const vec3& pos) {
+    float p[3] = {(float)pos.x, (float)pos.y, (float)pos.z};
+    uint32_t bits[3];
+    memcpy(bits, p, sizeof(bits));
+    uint64_t h = bits[0];
+    h = h * 0x9e3779b97f4a7c15ull ^ bits[1];
+    h = h * 0x9e3779b97f4a7c15ull ^ bits[2];
+    return h;
+}
+
+const vector<LightChoice>& SelectLights(const SceneSnapshot& scene, const HitInformation& hit) {
+    thread_local vector<LightChoice> choices;
+    choices.clear();
+    switch (light_selection) {
+        case LIGHTS_SAMPLED:
+            scene.light_tree.Sample(hit.pos, light_count, HitSeed(hit.pos), &choices);
+            break;
+        case LIGHTS_TOP_K:
+            scene.light_tree.TopK(hit.pos, light_count, &choices);
+            break;
+        default:
+            for (Light* light : scene.lights) {
+                choices.push_back(LightChoice{light, 1});
+            }
+    }
+    return choices;
+}
+
+Color CalculateDiffuse(Light* light, HitInformation hit) {
+    Color il = light->Intensity(hit.pos);
+    vec3 to_light = light->ReverseLightRay(hit.pos).dir;
+    float amount = fmax(0.0f, dot(hit.normal, to_light));
+    return hit.material->diffuse * il * amount;
+}
+
+Color CalculateSpecular(Light* light, HitInformation hit) {
+    vec3 to_light = light->ReverseLightRay(hit.pos).dir;
+    vec3 to_viewer = -hit.viewing;
+    Ray test = Ray::Reflect(to_light, hit.pos, hit.normal, -1);
+    float amount = pow(fmax(0.0f, dot(test.dir, to_viewer)), hit.material->phong);
+
+    Color il = light->Intensity(hit.pos);
+
+    return hit.material->specular * il * amount;
+}
+
+Color CalculateAmbient(const SceneSnapshot& scene, HitInformation hit) {
+    Color c = Color(0, 0, 0);
+
+    for (AmbientLight* al : scene.ambient_lights) {
+        c = c + hit.material->ambient * al->color;
+    }
+
+    return c;
+}
+
+
+void Camera::PreRender() {
+	mid_res = vec3i(res.x / 2, res.y / 2, 0);
+
+	forward = forward.normalized();
+	right = cross(forward, up).normalized();
+	up = cross(right, forward).normalized();
+}
+
+SceneSnapshot::SceneSnapshot(const Camera& camera) : camera(camera) {}
+
+SceneSnapshot::~SceneSnapshot() {
+    for (Geometry* geo : shapes) delete geo;
+    for (Light* light : lights) delete light;
+    for (Material* mat : materials) delete mat;
+}
+
+Accelerator* NewAccelerator(int type) {
+    switch (type) {
+        case ACCEL_BVH: return new BVH();
+        case ACCEL_GRID: return new Grid();
+        case ACCEL_WIDE_BVH: return new WideBVH();
+        default: return new LinearScan();
+    }
+}
+
+shared_ptr<SceneSnapshot> TakeSnapshot() {
+    // The editor reads the camera basis, so that is still worked out on the original.
+    camera->PreRender();
+
+    shared_ptr<SceneSnapshot> scene = make_shared<SceneSnapshot>(*camera);
+    unordered_map<const Material*, Material*> material_copies;
+    for (Material* mat : materials) {
+        scene->materials.push_back(new Material(*mat));
+        material_copies[mat] = scene->materials.back();
+    }
+    for (Geometry* geo : shapes) {
+        Geometry* copy = geo->Clone();
+        copy->material = material_copies[geo->material];
+        scene->shapes.push_back(copy);
+    }
+    for (Light* light : lights) {
+        scene->lights.push_back(light->Clone());
+        // Shown in the editor as a color in [0, 1] and a multiplier.
+        light->UpdateMult();
+        light->ClampColor();
+    }
+    scene->accelerator_type = accelerator_type;
+    return scene;
+}
+
+void PreRender(SceneSnapshot& scene) {
+    // The camera was prepared before it was copied, in TakeSnapshot().
+    if (scene.prepared)
+        return;
+    for (Geometry* geo : scene.shapes) geo->PreRender();
+    for (Light* light : scene.lights) light->PreRender();
+
+    for (Light* light : scene.lights) {
+        light->UpdateMult();
+        if (light->Type() == LIGHT_AMBIENT) {
+            scene.ambient_lights.push_back(static_cast<AmbientLight*>(light));
+        }
+    }
+    scene.light_tree.Build(scene.lights);
+    if (!scene.light_tree.lights.empty())
+        Log("light tree: " + to_string(scene.light_tree.nodes.size()) + " nodes over " +
+            to_string(scene.light_tree.lights.size()) + " lights");
+
+    for (Geometry* geo : scene.shapes) geo->AppendPrimitives(&scene.primitives);
+    scene.primitives.Finish();
+    Log(to_string(scene.primitives.Count()) + " primitives sharing " + to_string(scene.primitives.materials.size()) +
+        " materials");
+    if (scene.primitives.materials_overflowed)
+        Log("more than " + to_string(PRIM_MAX_MATERIALS) + " materials, the rest are drawn with the first");
+
+    scene.accelerator.reset(NewAccelerator(scene.accelerator_type));
+    steady_clock::time_point build_start = steady_clock::now();
+    scene.accelerator->Build(scene.primitives);
+    scene.accelerator->build_ms = duration<float, milli>(steady_clock::now() - build_start).count();
+    Log(scene.accelerator->Stats() + ", built in " + to_string(scene.accelerator->build_ms) + "ms");
+
+    vector<Instance*> instances;
+    for (Geometry* geo : scene.shapes) {
+        if (Instance* instance = dynamic_cast<Instance*>(geo))
+            instances.push_back(instance);
+    }
+    if (!instances.empty()) {
+        build_start = steady_clock::now();
+        scene.instances.Build(instances, scene.accelerator_type);
+        Log("top level: " + to_string(scene.instances.nodes.size()) + " nodes over " +
+            to_string(scene.instances.instances.size()) + " instances, built in " +
+            to_string(duration<float, milli>(steady_clock::now() - build_start).count()) + "ms");
+    }
+
+    scene.d = scene.camera.mid_res.y / tanf(scene.camera.half_vfov * (M_PI / 180.0f));
+    scene.prepared = true;
+}
+
+int SampleCount() {
+    if (sampling == AA_FIVE)
+        return 5;
+    if (sampling == AA_NONE || sampling == AA_ADAPTIVE)
+        return 1;
+    return sampling;
+}
+
+int PassCount() {
+    if (sampling == AA_FIVE || sampling == AA_NONE)
+        return SampleCount();
+    if (sampling == AA_ADAPTIVE)
+        return 2;
+    return PROGRESSIVE_MAX_PASSES;
+}
+
+// The sample_i-th sample of pixel (x, y). Random sampling follows the pixel's scrambled Sobol sequence, so the
+// same sample always lands in the same place. Adaptive sampling starts with the center, then takes the AA_FIVE
+// corners before going on with the sequence.
+SampleOffset SampleOffsetAt(int x, int y, int sample_i) {
+    static const SampleOffset five[5] = {{0.50, 0.50}, {0.15, 0.15}, {0.85, 0.15}, {0.85, 0.85}, {0.15, 0.85}};
+    if (sampling == AA_FIVE)
+        return five[sample_i % 5];
+    if (sampling == AA_NONE)
+        return SampleOffset{0.5, 0.5};
+    if (sampling == AA_ADAPTIVE) {
+        if (sample_i < 5)
+            return five[sample_i];
+        sample_i -= 5;
+    }
+    SampleOffset offset;
+    PixelSampler(x, y).Point(sample_i, &offset.x, &offset.y);
+    return offset;
+}
+
+Ray CameraRay(const SceneSnapshot& scene, int x, int y, SampleOffset offset) {
+    const Camera& cam = scene.camera;
+    float u = cam.mid_res.x - x + offset.x;
+    float v = cam.mid_res.y - y + offset.y;
+
+    vec3 rayDir = (scene.d * cam.forward + u * cam.right + v * cam.up).normalized();
+
+    return Ray(cam.position, rayDir, cam.max_depth);
+}
+
+// Adds samples [first, first + count) of every pixel in the tile to sums, a camera.res sized row-major buffer.
+// Works in PACKET_W x PACKET_H blocks of pixels, one sample of every pixel in the block per packet.
+void TraceTilePackets(const SceneSnapshot& scene, const Tile& tile, int first, int count, Color* sums) {
+    int blocks_x = (tile.x1 - tile.x0 + PACKET_W - 1) / PACKET_W;
+    int blocks_y = (tile.y1 - tile.y0 + PACKET_H - 1) / PACKET_H;
+    for (int i = 0; i < blocks_x * blocks_y; i++) {
+        int x0 = tile.x0 + (i % blocks_x) * PACKET_W;
+        int y0 = tile.y0 + (i / blocks_x) * PACKET_H;
+
+        int active = 0;
+        for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+            if (x0 + lane % PACKET_W < tile.x1 && y0 + lane / PACKET_W < tile.y1)
+                active |= 1 << lane;
+        }
+
+        for (int samp_i = first; samp_i < first + count; samp_i++) {
+            RayPacket packet;
+            packet.active = active;
+            for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+                if (active & (1 << lane)) {
+                    int x = x0 + lane % PACKET_W, y = y0 + lane / PACKET_W;
+                    packet.rays[lane] = CameraRay(scene, x, y, SampleOffsetAt(x, y, samp_i));
+                }
+            }
+            packet.Prepare();
+
+            Color new_colors[SIMD_WIDTH];
+            EvaluatePacket(scene, packet, new_colors);
+            for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+                if (!(active & (1 << lane)))
+                    continue;
+                new_colors[lane].Clamp();
+                Color& sum = sums[(y0 + lane / PACKET_W) * scene.camera.res.x + x0 + lane % PACKET_W];
+                sum = sum + new_colors[lane];
+            }
+        }
+    }
+}
+
+void TraceTile(const SceneSnapshot& scene, const Tile& tile, int first, int count, Color* sums) {
+    for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x = tile.x0; x < tile.x1; x++) {
+            Color& sum = sums[y * scene.camera.res.x + x];
+            for (int samp_i = first; samp_i < first + count; samp_i++) {
+                Color new_color = EvaluateRay(scene, CameraRay(scene, x, y, SampleOffsetAt(x, y, samp_i)));
+                new_color.Clamp();
+                sum = sum + new_color;
+            }
+        }
+    }
+}
+
+// Traces samples [first, first + count) of every pixel into sums, then writes sums / samples to image.
+// Tiles not yet started when the scene is cancelled are skipped. Returns false if that happened.
+bool RenderSamples(const SceneSnapshot& scene, int first, int count, int samples, Color* sums, Image* image) {
+    int width = scene.camera.res.x;
+    tile_scheduler.Run(width, scene.camera.res.y, render_threads, [&](const Tile& tile) {
+        if (scene.cancelled)
+            return;
+        if (wavefront) {
+            TraceTileWavefront(scene, tile, first, count, sums);
+        } else {
+#if PACKET_TRACING
+            TraceTilePackets(scene, tile, first, count, sums);
+#else
+            TraceTile(scene, tile, first, count, sums);
+#endif
+        }
+        for (int y = tile.y0; y < tile.y1; y++) {
+            for (int x = tile.x0; x < tile.x1; x++) {
+                image->setPixel(x, y, sums[y * width + x] * (1.0f / samples));
+            }
+        }
+        ray_total += rays_traced;
+        rays_traced = 0;
+    });
+    return !scene.cancelled;
+}
+
+// What the adaptive sampling thresholds are measured in.
+static float Luminance(const Color& c) {
+    return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
+// Adds samples [first, first + count) of pixel (x, y) to sum, and their luminance and its square to the others.
+static void TracePixel(const SceneSnapshot& scene, int x, int y, int first, int count, Color* sum, float* luminance,
+                       float* luminance2) {
+    if (wavefront) {
+        vector<Color> new_colors(count);
+        TracePixelWavefront(scene, x, y, first, count, new_colors.data());
+        for (const Color& new_color : new_colors) {
+            *sum = *sum + new_color;
+            float l = Luminance(new_color);
+            *luminance += l;
+            *luminance2 += l * l;
+        }
+        return;
+    }
+#if PACKET_TRACING
+    // The samples of one pixel make about the most coherent packet there is.
+    for (int batch = first; batch < first + count; batch += SIMD_WIDTH) {
+        int lanes = min(SIMD_WIDTH, first + count - batch);
+        RayPacket packet;
+        packet.active = (1 << lanes) - 1;
+        for (int lane = 0; lane < lanes; lane++) {
+            packet.rays[lane] = CameraRay(scene, x, y, SampleOffsetAt(x, y, batch + lane));
+        }
+        packet.Prepare();
+
+        Color new_colors[SIMD_WIDTH];
+        EvaluatePacket(scene, packet, new_colors);
+        for (int lane = 0; lane < lanes; lane++) {
+            new_colors[lane].Clamp();
+            *sum = *sum + new_colors[lane];
+            float l = Luminance(new_colors[lane]);
+            *luminance += l;
+            *luminance2 += l * l;
+        }
+    }
+#else
+    for (int samp_i = first; samp_i < first + count; samp_i++) {
+        Color new_color = EvaluateRay(scene, CameraRay(scene, x, y, SampleOffsetAt(x, y, samp_i)));
+        new_color.Clamp();
+        *sum = *sum + new_color;
+        float l = Luminance(new_color);
+        *luminance += l;
+        *luminance2 += l * l;
+    }
+#endif
+}
+
+// The second pass of AA_ADAPTIVE, after one centered sample of every pixel went into sums. A pixel whose luminance
+// differs from one of its 8 neighbors by more than adaptive_threshold gets the four AA_FIVE corner samples, then
+// ADAPTIVE_BATCH more at a time until the standard error of its mean luminance drops below adaptive_threshold
+// or it reaches adaptive_max_samples. Writes sums / samples of every pixel to image.
+bool RefineSamples(const SceneSnapshot& scene, Color* sums, Image* image) {
+    int width = scene.camera.res.x, height = scene.camera.res.y;
+    // Neighbors are compared before any tile adds samples, so the result doesn't depend on the tile order.
+    vector<Color> first_pass(sums, sums + width * height);
+    atomic<long long> refined_pixels{0}, total_samples{0};
+    tile_scheduler.Run(width, height, render_threads, [&](const Tile& tile) {
+        if (scene.cancelled)
+            return;
+        long long refined = 0, samples = 0;
+        for (int y = tile.y0; y < tile.y1; y++) {
+            for (int x = tile.x0; x < tile.x1; x++) {
+                float luminance = Luminance(first_pass[y * width + x]);
+                float contrast = 0;
+                for (int ny = max(0, y - 1); ny <= min(height - 1, y + 1); ny++) {
+                    for (int nx = max(0, x - 1); nx <= min(width - 1, x + 1); nx++) {
+                        contrast = fmax(contrast, fabs(Luminance(first_pass[ny * width + nx]) - luminance));
+                    }
+                }
+
+                Color& sum = sums[y * width + x];
+                int n = 1;
+                if (contrast > adaptive_threshold && adaptive_max_samples > 1) {
+                    float luminance2 = luminance * luminance;
+                    int corners = min(4, adaptive_max_samples - 1);
+                    TracePixel(scene, x, y, n, corners, &sum, &luminance, &luminance2);
+                    n += corners;
+                    while (n < adaptive_max_samples) {
+                        float mean = luminance / n;
+                        float variance = fmax(0.0f, (luminance2 / n - mean * mean) * n / (n - 1));
+                        if (sqrt(variance / n) <= adaptive_threshold)
+                            break;
+                        int batch = min(ADAPTIVE_BATCH, adaptive_max_samples - n);
+                        TracePixel(scene, x, y, n, batch, &sum, &luminance, &luminance2);
+                        n += batch;
+                    }
+                    refined++;
+                }
+                samples += n;
+                image->setPixel(x, y, sum * (1.0f / n));
+            }
+        }
+        refined_pixels += refined;
+        total_samples += samples;
+        ray_total += rays_traced;
+        rays_traced = 0;
+    });
+    if (scene.cancelled)
+        return false;
+    float pixels = width * height;
+    Log("adaptive sampling refined " + to_string(100 * refined_pixels / pixels) + "% of pixels, " +
+        to_string(total_samples / pixels) + " samples per pixel");
+    return true;
+}
+
+bool RenderImage(SceneSnapshot& scene, Image* outputImg) {
+    PreRender(scene);
+
+    ray_total = 0;
+    wavefront_stats.Reset();
+    steady_clock::time_point render_start = steady_clock::now();
+    vector<Color> sums(scene.camera.res.x * scene.camera.res.y);
+    bool done = RenderSamples(scene, 0, SampleCount(), SampleCount(), sums.data(), outputImg);
+    if (done && sampling == AA_ADAPTIVE)
+        done = RefineSamples(scene, sums.data(), outputImg);
+    if (!done) {
+        Log("render cancelled");
+        return false;
+    }
+    float render_s = duration<float>(steady_clock::now() - render_start).count();
+    Log(to_string(tile_scheduler.ThreadCount()) + " threads, " + to_string(tile_scheduler.steals.load()) + " tiles stolen");
+    Log(to_string(ray_total.load()) + " rays in " + to_string(render_s) + "s, " +
+        to_string((long long)(ray_total / fmax(render_s, 1e-6))) + " rays/sec");
+    if (wavefront)
+        Log(wavefront_stats.Summary());
+#if PACKET_VALIDATE
+    Log(to_string(packet_mismatches.exchange(0)) + " packet lanes disagreed with single rays");
+#endif
+    return true;
+}
+
+void RestartAccumulation(Accumulator* acc) {
+    acc->scene = TakeSnapshot();
+    acc->passes = 0;
+}
+
+bool RenderPass(Accumulator* acc, Image* image) {
+    SceneSnapshot& scene = *acc->scene;
+    if (acc->passes >= PassCount() || scene.cancelled)
+        return false;
+    if (acc->passes == 0) {
+        PreRender(scene);
+        acc->sums.assign(scene.camera.res.x * scene.camera.res.y, Color(0, 0, 0));
+        acc->start = steady_clock::now();
+        ray_total = 0;
+        wavefront_stats.Reset();
+    }
+
+    bool done;
+    if (sampling == AA_ADAPTIVE && acc->passes == 1) {
+        done = RefineSamples(scene, acc->sums.data(), image);
+    } else {
+        done = RenderSamples(scene, acc->passes, 1, acc->passes + 1, acc->sums.data(), image);
+    }
+    if (!done)
+        return false;
+    acc->passes++;
+
+    float render_s = duration<float>(steady_clock::now() - acc->start).count();
+    if (acc->passes == 1)
+        Log("first pass in " + to_string(render_s) + "s");
+    if (acc->passes == PassCount()) {
+        Log(to_string(acc->passes) + " passes, " + to_string(ray_total.load()) + " rays in " + to_string(render_s) + "s");
+        if (wavefront)
+            Log(wavefront_stats.Summary());
+    }
+    return true;
+}
+
+void Render() {
+    shared_ptr<SceneSnapshot> scene = TakeSnapshot();
+	Image outputImg = Image(scene->camera.res.x, scene->camera.res.y);
+    RenderImage(*scene, &outputImg);
+
+    string relative_output_name = "output/" + string(output_name);
+    outputImg.write(relative_output_name.c_str());
+}
+
+void RenderOne() {
+    shared_ptr<SceneSnapshot> scene = TakeSnapshot();
+    PreRender(*scene);
+
+    const Camera& cam = scene->camera;
+    Ray ray = Ray(cam.position, cam.forward.normalized(), cam.max_depth);
+    Color new_color = EvaluateRay(*scene, ray);
+    new_color.Clamp();
+}
+
+bool FindIntersection(const SceneSnapshot& scene, const Ray& ray, HitInformation* intersection) {
+    rays_traced++;
+    bool hit = scene.accelerator->FindIntersection(ray, intersection);
+    if (scene.instances.Empty())
+        return hit;
+    return scene.instances.FindIntersection(ray, hit ? intersection->dist : INFINITY, intersection) || hit;
+}
+
+int FindIntersection(const SceneSnapshot& scene, const RayPacket& packet, HitInformation* hits) {
+    rays_traced += bitset<SIMD_WIDTH>(packet.active).count();
+    int hit_mask = scene.accelerator->FindIntersection(packet, hits);
+    if (scene.instances.Empty())
+        return hit_mask;
+    // The top level is traced a lane at a time, each lane only looking for instances closer than what it hit.
+    for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+        if (!(packet.active & (1 << lane)))
+            continue;
+        float t_max = (hit_mask & (1 << lane)) ? hits[lane].dist : INFINITY;
+        if (scene.instances.FindIntersection(packet.rays[lane], t_max, &hits[lane]))
+            hit_mask |= 1 << lane;
+    }
+    return hit_mask;
+}
+
+bool Occluded(const SceneSnapshot& scene, const Ray& ray, float t_max) {
+    rays_traced++;
+    return scene.accelerator->Occluded(ray, t_max) || scene.instances.Occluded(ray, t_max);
+}
+
+void Log(string s) {
+    lock_guard<mutex> guard(debug_log_lock);
+    debug_log.push_back(s);
+    if (debug_log.size() > 100) {
+        debug_log.erase(debug_log.begin(), debug_log.begin() + 20);
+    }
+}
+
+}  // namespace Raytracer
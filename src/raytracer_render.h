@@ -0,0 +1,239 @@
+#ifndef _RAYTRACER_RENDER_H
+#define _RAYTRACER_RENDER_H
+
+// Scene state and the renderer itself. Nothing here depends on SDL, OpenGL or ImGui, so it is
+// shared by the editor (raytracer_main.cpp) and the headless renderer (raytracer_cli.cpp).
+
+#include <image_lib.h>
+#include <vec3.h>
+#include <atomic>
+#include <bitset>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "raytracer_ray.h"
+#include "raytracer_light.h"
+#include "raytracer_light_tree.h"
+#include "raytracer_geometry.h"
+#include "raytracer_bvh.h"
+#include "raytracer_grid.h"
+#include "raytracer_instance.h"
+#include "raytracer_wide_bvh.h"
+#include "raytracer_scheduler.h"
+#include "raytracer_scene_writer.h"
+#include "raytracer_wavefront.h"
+
+
+using namespace std;
+using namespace std::chrono;
+
+// User settings
+#define AA_RANDOM 4
+#define AA_NONE 0
+#define AA_FIVE -1
+#define AA_ADAPTIVE -2
+#define SAMPLING AA_NONE // starting value of sampling, any value > 0 is that many samples along each pixel's Sobol sequence.
+#define ADAPTIVE_MAX_SAMPLES 32 // starting value of adaptive_max_samples
+#define ADAPTIVE_THRESHOLD 0.02f // starting value of adaptive_threshold
+#define ADAPTIVE_BATCH 8 // samples added to a pixel at a time once adaptive sampling has started on it
+#define PROGRESSIVE_MAX_PASSES 1024 // passes before progressive random sampling stops
+#define RENDER_THREADS 0 // starting value of render_threads, 0 uses every hardware thread
+#define PACKET_TRACING 1 // trace camera rays SIMD_WIDTH at a time, see raytracer_packet.h
+#define PACKET_VALIDATE 0 // re-trace every packet lane as a single ray and log any disagreement
+#define LIGHTS_ALL 0
+#define LIGHTS_SAMPLED 1
+#define LIGHTS_TOP_K 2
+#define LIGHT_SELECTION LIGHTS_ALL // starting value of light_selection, see raytracer_light_tree.h
+#define LIGHT_COUNT 8 // starting value of light_count
+#define WAVEFRONT 0 // starting value of wavefront, trace a tile a stage at a time rather than a path at a time, see raytracer_wavefront.h
+
+// Constants
+#define CHARARRAY_LEN 256
+// Deepest chain of hits a path can have. A ray that would go past it is treated as out of bounces.
+#define MAX_PATH_DEPTH 64
+
+namespace Raytracer {
+
+struct Camera : Object {
+    vec3 position = vec3(0, 0, 0);
+    vec3 forward = vec3(-1, 0, 0), up = vec3(0, 1, 0), right = vec3(0, 0, 0);
+    Color background_color = Color(0, 0, 0);
+    float half_vfov = 45;
+    vec3i res = vec3i(640, 480, 0);
+    vec3i mid_res;
+    int max_depth = 5;
+
+    using Object::Object;
+
+#ifndef RAYTRACER_HEADLESS
+    void ImGui();
+#endif
+    void Encode(SceneWriter& out);
+    // Camera settings are spread over several keys, so it decodes by key rather than by line.
+    void Decode(SceneKey key, FieldReader& in);
+	void PreRender();
+};
+
+struct LoadState {
+    vector<vec3> vertices{};
+    vector<vec3> normals{};
+    // Values of the vertex: and normal: lines, parsed in parallel once the whole file has been scanned.
+    vector<FieldReader> vertex_fields{};
+    vector<FieldReader> normal_fields{};
+    // Meshes created by this load. They get the vertex and normal buffers once the file is read.
+    vector<Mesh*> meshes{};
+    // Sphere clouds created by this load.
+    vector<SphereCloud*> clouds{};
+    // What the next shapes are made of, as set by the last material: line.
+    Material* material = NULL;
+    // The object whose lines are being read, NULL outside of object: and end_object:. Shapes go into it instead
+    // of the scene.
+    shared_ptr<Prototype> prototype{};
+    // Where meshes and clouds stop being mergeable with the next lines, as an object starts or ends.
+    size_t first_mesh = 0;
+    size_t first_cloud = 0;
+};
+
+// Position of a sample inside its pixel, both in [0, 1].
+struct SampleOffset {
+    float x, y;
+};
+
+// Copy of everything a render reads, taken by TakeSnapshot() on the thread that edits the scene. Renders only
+// read their snapshot, so the editor can keep changing the scene, or delete from it, while they run.
+struct SceneSnapshot {
+    Camera camera;
+    // Owned copies. Shapes point at the copied materials.
+    vector<Material*> materials;
+    vector<Geometry*> shapes;
+    vector<Light*> lights;
+    int accelerator_type = ACCEL_BVH;
+
+    // Filled in by PreRender().
+    bool prepared = false;
+    // The shapes compiled into flat arrays, which the accelerator indexes into.
+    PrimitiveArrays primitives;
+    vector<AmbientLight*> ambient_lights;
+    LightTree light_tree;
+    unique_ptr<Accelerator> accelerator;
+    // Top level over the instances among the shapes, traced after the accelerator.
+    InstanceTree instances;
+    // Distance to the image plane.
+    float d = 0;
+
+    // Set from any thread to stop renders of this snapshot. Checked before every tile.
+    atomic<bool> cancelled{false};
+
+    SceneSnapshot(const Camera& camera);
+    SceneSnapshot(const SceneSnapshot&) = delete;
+    ~SceneSnapshot();
+};
+
+// Per-pixel sums of the samples traced so far by progressive rendering. Each pass adds one sample to every pixel.
+struct Accumulator {
+    shared_ptr<SceneSnapshot> scene;
+    vector<Color> sums;
+    int passes = 0;
+    steady_clock::time_point start;
+};
+
+// SCENE STATE
+extern int entity_count;
+extern Camera* camera;
+extern vector<Geometry*> shapes;
+extern vector<Material*> materials;
+extern vector<Light*> lights;
+// Objects the loaded scene defined, placed by the Instance shapes.
+extern vector<shared_ptr<Prototype>> prototypes;
+extern char scene_name[CHARARRAY_LEN];
+extern char output_name[CHARARRAY_LEN];
+extern vector<string> debug_log;
+// Held by Log(). Renders log from their own threads, so hold it to read debug_log while one may be running.
+extern mutex debug_log_lock;
+extern LoadState load_state;
+extern int accelerator_type;
+// One of AA_NONE, AA_FIVE, AA_ADAPTIVE or a random sample count.
+extern int sampling;
+// AA_ADAPTIVE: most samples any one pixel gets, and the luminance difference that earns a pixel more.
+extern int adaptive_max_samples;
+extern float adaptive_threshold;
+extern int render_threads;
+// One of LIGHTS_ALL, LIGHTS_SAMPLED or LIGHTS_TOP_K, and how many point and spot lights the other two shade a hit with.
+extern int light_selection;
+extern int light_count;
+// Trace with TraceTileWavefront() instead of EvaluateRay().
+extern bool wavefront;
+extern TileScheduler tile_scheduler;
+
+
+vector<Geometry*>::iterator GetIter(Geometry* geo);
+vector<Light*>::iterator GetIter(Light* light);
+void Delete(Geometry* geo);
+void Delete(Light* light);
+// The material in materials with the same parameters as mat, added as a copy if there is none yet. Shapes
+// share materials through this, so a scene has one of each no matter how many lines or buttons asked for it.
+Material* InternMaterial(const Material& mat);
+// Deletes the materials no shape uses anymore. The first one is always kept.
+void PruneMaterials();
+// Empty accelerator of the given AcceleratorType.
+Accelerator* NewAccelerator(int type);
+
+
+
+bool FindIntersection(const SceneSnapshot& scene, const Ray& ray, HitInformation* intersection);
+int FindIntersection(const SceneSnapshot& scene, const RayPacket& packet, HitInformation* hits);
+bool Occluded(const SceneSnapshot& scene, const Ray& ray, float t_max);
+Color EvaluateRay(const SceneSnapshot& scene, Ray ray);
+void EvaluatePacket(const SceneSnapshot& scene, const RayPacket& packet, Color* colors);
+// Lights to shade hit with under light_selection, and their weights. The list is reused by the next call on the same thread.
+const vector<LightChoice>& SelectLights(const SceneSnapshot& scene, const HitInformation& hit);
+Color CalculateDiffuse(Light* light, HitInformation hit);
+Color CalculateSpecular(Light* light, HitInformation hit);
+Color CalculateAmbient(const SceneSnapshot& scene, HitInformation hit);
+// Where the sample_i-th sample of pixel (x, y) goes under the current sampling, and the camera ray through it.
+SampleOffset SampleOffsetAt(int x, int y, int sample_i);
+Ray CameraRay(const SceneSnapshot& scene, int x, int y, SampleOffset offset);
+
+void Reset();
+// Replaces the scene with the file at path, text or binary by its extension. Returns false, leaving an empty
+// scene, if it can't be opened.
+bool LoadFile(const string& path);
+// Binary .p3b scenes, see raytracer_binary_scene.h. Loading one gives the same scene as the .p3 it was saved from.
+bool LoadBinaryFile(const string& path);
+bool SaveBinaryFile(const string& path);
+// Loads scenes/<scene_name>.p3, or its .p3b if that was saved more recently.
+void Load();
+void Save();
+// Writes scenes/<scene_name>.p3b.
+void SaveBinary();
+// Copies the current scene. Cheap next to PreRender(), so call it from the editing thread and leave the rest
+// to the render.
+shared_ptr<SceneSnapshot> TakeSnapshot();
+// Precomputes the snapshot's shapes and lights and builds its accelerator. Does nothing the second time.
+void PreRender(SceneSnapshot& scene);
+// Renders into image, which must be scene.camera.res in size. Returns false if the scene was cancelled
+// first, leaving the image partly drawn.
+bool RenderImage(SceneSnapshot& scene, Image* image);
+// Samples per pixel of a full render under the current sampling. For AA_ADAPTIVE, the samples every pixel starts with.
+int SampleCount();
+// Passes progressive rendering makes before it stops: the fixed patterns run out, random sampling goes on
+// up to PROGRESSIVE_MAX_PASSES. AA_ADAPTIVE makes its first pass, then a second that refines it.
+int PassCount();
+// Drops the accumulated samples and snapshots the current scene for the next passes.
+void RestartAccumulation(Accumulator* acc);
+// Adds one sample of every pixel to acc, or under AA_ADAPTIVE refines it, and writes the running average into
+// image, which must be acc->scene->camera.res in size. Returns false once PassCount() passes are done or the scene is cancelled.
+bool RenderPass(Accumulator* acc, Image* image);
+// Renders and writes output/<output_name>. The editor renders with RenderImage() and only writes on request.
+void Render();
+void RenderOne();
+
+void Log(string s);
+
+}  // namespace Raytracer
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef _RAYTRACER_SAMPLER_H
+#define _RAYTRACER_SAMPLER_H
+
+#include <stdint.h>
+
+// Seed of every pixel's random stream. Renders with the same seed come out the same bit for bit.
+#define SAMPLER_SEED 0x5eedu
+
+namespace Raytracer {
+
+// PCG32 (O'Neill, pcg-random.org): 64 bits of state, 32 bit outputs. Each pixel gets its own stream, so no
+// render thread ever touches another's state.
+struct PCG32 {
+    uint64_t state = 0;
+    uint64_t inc = 1;
+
+    PCG32(uint64_t seed, uint64_t stream) {
+        inc = (stream << 1) | 1;
+        Next();
+        state += seed;
+        Next();
+    }
+
+    uint32_t Next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + inc;
+        uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+        uint32_t rot = (uint32_t)(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    // Uniform in [0, 1).
+    float NextFloat() { return (Next() >> 8) * (1.0f / 16777216.0f); }
+};
+
+// The first two dimensions of the Sobol sequence, as 32 bit fractions. Together they form a (0, 2)-sequence:
+// every power of two run of points is stratified over the pixel, so averages converge faster than with
+// independent random points.
+inline uint32_t Sobol0(uint32_t i) {
+    uint32_t r = 0;
+    for (uint32_t v = 1u << 31; i; i >>= 1, v >>= 1)
+        if (i & 1) r ^= v;
+    return r;
+}
+
+inline uint32_t Sobol1(uint32_t i) {
+    uint32_t r = 0;
+    for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1)
+        if (i & 1) r ^= v;
+    return r;
+}
+
+// Sample positions and random numbers of one pixel, a pure function of the pixel and SAMPLER_SEED.
+// A sample's position only depends on its index, so any thread can trace any sample in any order.
+struct PixelSampler {
+    PCG32 rng;
+    // Random digit scrambles of the Sobol points. XORing keeps their stratification but decorrelates pixels.
+    uint32_t scramble_x, scramble_y;
+
+    PixelSampler(int x, int y) : rng(SAMPLER_SEED, ((uint64_t)(uint32_t)y << 32) | (uint32_t)x) {
+        scramble_x = rng.Next();
+        scramble_y = rng.Next();
+    }
+
+    // Position of the index-th sample inside the pixel, both in [0, 1).
+    void Point(uint32_t index, float* x, float* y) const {
+        *x = ((Sobol0(index) ^ scramble_x) >> 8) * (1.0f / 16777216.0f);
+        *y = ((Sobol1(index) ^ scramble_y) >> 8) * (1.0f / 16777216.0f);
+    }
+};
+
+}  // namespace Raytracer
+
+#endif
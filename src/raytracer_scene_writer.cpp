@@ -0,0 +1,129 @@
+#include "raytracer_scene_writer.h"
+
+#include <charconv>
+#include <string.h>
+
+namespace Raytracer {
+
+size_t SceneWriter::VecHash::operator()(const vec3& v) const {
+    hash<float> h;
+    return h(v.x) ^ (h(v.y) * 0x9e3779b9) ^ (h(v.z) * 0x85ebca6b);
+}
+
+// Bitwise, so 0 and -0 stay separate lines and the file reads back exactly.
+bool SceneWriter::VecEqual::operator()(const vec3& a, const vec3& b) const {
+    return memcmp(&a, &b, sizeof(vec3)) == 0;
+}
+
+SceneWriter& SceneWriter::operator<<(const char* key) {
+    size_t len = strlen(key);
+    Reserve(len + 1);
+    if (line_open) buffer[used++] = '\n';
+    memcpy(buffer + used, key, len);
+    used += len;
+    line_open = true;
+    return *this;
+}
+
+SceneWriter& SceneWriter::operator<<(float value) {
+    Reserve(32);
+    buffer[used++] = ' ';
+    used = to_chars(buffer + used, buffer + sizeof(buffer), value).ptr - buffer;
+    return *this;
+}
+
+SceneWriter& SceneWriter::operator<<(double value) {
+    Reserve(32);
+    buffer[used++] = ' ';
+    used = to_chars(buffer + used, buffer + sizeof(buffer), value).ptr - buffer;
+    return *this;
+}
+
+SceneWriter& SceneWriter::operator<<(int value) {
+    Reserve(16);
+    buffer[used++] = ' ';
+    used = to_chars(buffer + used, buffer + sizeof(buffer), value).ptr - buffer;
+    return *this;
+}
+
+SceneWriter& SceneWriter::operator<<(uint32_t value) {
+    Reserve(16);
+    buffer[used++] = ' ';
+    used = to_chars(buffer + used, buffer + sizeof(buffer), value).ptr - buffer;
+    return *this;
+}
+
+SceneWriter& SceneWriter::Word(const char* word) {
+    size_t len = strlen(word);
+    Reserve(len + 1);
+    buffer[used++] = ' ';
+    memcpy(buffer + used, word, len);
+    used += len;
+    return *this;
+}
+
+void SceneWriter::UseMaterial(const Material* mat) {
+    if (material != NULL && (mat == material || mat->Matches(*material)))
+        return;
+    material = mat;
+    *this << "material:" << mat->ambient << mat->diffuse << mat->specular << mat->phong << mat->transmissive << mat->ior;
+}
+
+uint32_t SceneWriter::VertexBuffer(const vector<vec3>* buffer) {
+    auto found = vertex_buffers.find(buffer);
+    if (found != vertex_buffers.end())
+        return found->second;
+    uint32_t first = vertex_count;
+    for (const vec3& v : *buffer) {
+        *this << "vertex:" << v;
+    }
+    vertex_count += buffer->size();
+    return vertex_buffers[buffer] = first;
+}
+
+uint32_t SceneWriter::NormalBuffer(const vector<vec3>* buffer) {
+    auto found = normal_buffers.find(buffer);
+    if (found != normal_buffers.end())
+        return found->second;
+    uint32_t first = normal_count;
+    for (const vec3& n : *buffer) {
+        *this << "normal:" << n;
+    }
+    normal_count += buffer->size();
+    return normal_buffers[buffer] = first;
+}
+
+uint32_t SceneWriter::Vertex(const vec3& v) {
+    auto inserted = vertices.insert({v, vertex_count});
+    if (inserted.second) {
+        *this << "vertex:" << v;
+        vertex_count++;
+    }
+    return inserted.first->second;
+}
+
+uint32_t SceneWriter::Normal(const vec3& n) {
+    auto inserted = normals.insert({n, normal_count});
+    if (inserted.second) {
+        *this << "normal:" << n;
+        normal_count++;
+    }
+    return inserted.first->second;
+}
+
+void SceneWriter::Finish() {
+    if (line_open) {
+        Reserve(1);
+        buffer[used++] = '\n';
+        line_open = false;
+    }
+    Flush();
+}
+
+void SceneWriter::Flush() {
+    out.write(buffer, used);
+    flushed += used;
+    used = 0;
+}
+
+}  // namespace Raytracer
@@ -0,0 +1,81 @@
+#ifndef _RAYTRACER_SCENE_WRITER_H
+#define _RAYTRACER_SCENE_WRITER_H
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vec3.h>
+#include "raytracer_ray.h"
+
+using namespace std;
+
+namespace Raytracer {
+
+// Streams a scene file for Save(). Same rule as the ossstream it replaced: a string literal starts a new
+// line with that key, anything else is a value after a space. Numbers are formatted with to_chars into a
+// buffer that goes out in large blocks, and they read back to the same float.
+//
+// It also keeps the file compact: a material is only written when it changes between shapes, and each
+// vertex or normal is written once, with every triangle that shares it pointing at the same line.
+struct SceneWriter {
+    SceneWriter(ostream& out) : out(out) {}
+    SceneWriter(const SceneWriter&) = delete;
+    ~SceneWriter() { Finish(); }
+
+    SceneWriter& operator<<(const char* key);
+    SceneWriter& operator<<(float value);
+    SceneWriter& operator<<(double value);
+    SceneWriter& operator<<(int value);
+    SceneWriter& operator<<(uint32_t value);
+    SceneWriter& operator<<(const vec3& v) { return *this << v.x << v.y << v.z; }
+    SceneWriter& operator<<(const Color& c) { return *this << c.r << c.g << c.b; }
+    // A value that is a word rather than a number, like the output image name.
+    SceneWriter& Word(const char* word);
+
+    // Writes a material: line unless the last one written has the same parameters.
+    void UseMaterial(const Material* material);
+    // Index of the first line of a mesh buffer, writing the buffer the first time it's seen.
+    uint32_t VertexBuffer(const vector<vec3>* buffer);
+    uint32_t NormalBuffer(const vector<vec3>* buffer);
+    // Index of a single vertex or normal, written unless the same value was written before.
+    uint32_t Vertex(const vec3& v);
+    uint32_t Normal(const vec3& n);
+
+    // Ends the last line and writes out the buffer.
+    void Finish();
+    void Flush();
+    size_t BytesWritten() const { return flushed + used; }
+
+  private:
+    struct VecHash {
+        size_t operator()(const vec3& v) const;
+    };
+    struct VecEqual {
+        bool operator()(const vec3& a, const vec3& b) const;
+    };
+
+    ostream& out;
+    char buffer[1 << 16];
+    size_t used = 0;
+    size_t flushed = 0;
+    bool line_open = false;
+
+    const Material* material = NULL;
+    uint32_t vertex_count = 0;
+    uint32_t normal_count = 0;
+    unordered_map<const vector<vec3>*, uint32_t> vertex_buffers;
+    unordered_map<const vector<vec3>*, uint32_t> normal_buffers;
+    unordered_map<vec3, uint32_t, VecHash, VecEqual> vertices;
+    unordered_map<vec3, uint32_t, VecHash, VecEqual> normals;
+
+    // Room for any one value, so numbers are formatted straight into the buffer.
+    void Reserve(size_t bytes) {
+        if (used + bytes > sizeof(buffer)) Flush();
+    }
+};
+
+}  // namespace Raytracer
+
+#endif
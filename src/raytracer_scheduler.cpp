@@ -0,0 +1,149 @@
+#include "raytracer_scheduler.h"
+
+#include <algorithm>
+#include <stdint.h>
+
+namespace Raytracer {
+
+int HardwareThreads() {
+	return max(1, (int)thread::hardware_concurrency());
+}
+
+// Spreads the low 16 bits of x out to the even bits.
+static uint32_t SpreadBits(uint32_t x) {
+	x &= 0xffff;
+	x = (x | (x << 8)) & 0x00ff00ff;
+	x = (x | (x << 4)) & 0x0f0f0f0f;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+	return x;
+}
+
+static uint32_t MortonCode(int x, int y) {
+	return SpreadBits(x) | (SpreadBits(y) << 1);
+}
+
+TileScheduler::~TileScheduler() {
+	Resize(1);
+}
+
+void TileScheduler::Resize(int threads) {
+	if (threads - 1 == (int)workers.size() && (int)queues.size() == threads)
+		return;
+
+	{
+		lock_guard<mutex> guard(lock);
+		quit = true;
+	}
+	wake.notify_all();
+	for (thread& worker : workers) {
+		worker.join();
+	}
+	workers.clear();
+	quit = false;
+
+	queues.clear();
+	for (int i = 0; i < threads; i++) {
+		queues.push_back(make_unique<Queue>());
+	}
+	// Index 0 is the thread calling Run().
+	for (int i = 1; i < threads; i++) {
+		workers.push_back(thread(&TileScheduler::WorkerLoop, this, i));
+	}
+}
+
+void TileScheduler::Run(int width, int height, int threads, const function<void(const Tile&)>& work) {
+	lock_guard<mutex> run_guard(run_lock);
+	Resize(max(1, threads));
+	steals = 0;
+
+	int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+	vector<pair<uint32_t, Tile>> ordered;
+	ordered.reserve(tiles_x * tiles_y);
+	for (int ty = 0; ty < tiles_y; ty++) {
+		for (int tx = 0; tx < tiles_x; tx++) {
+			Tile tile{tx * TILE_SIZE, ty * TILE_SIZE, min(width, (tx + 1) * TILE_SIZE), min(height, (ty + 1) * TILE_SIZE)};
+			ordered.push_back({MortonCode(tx, ty), tile});
+		}
+	}
+	sort(ordered.begin(), ordered.end(), [](const pair<uint32_t, Tile>& a, const pair<uint32_t, Tile>& b) { return a.first < b.first; });
+
+	// Contiguous runs of the curve, as even as possible.
+	int count = queues.size();
+	for (int i = 0; i < count; i++) {
+		size_t begin = ordered.size() * i / count;
+		size_t end = ordered.size() * (i + 1) / count;
+		for (size_t t = begin; t < end; t++) {
+			queues[i]->tiles.push_back(ordered[t].second);
+		}
+	}
+
+	{
+		lock_guard<mutex> guard(lock);
+		job = &work;
+		busy = workers.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	Drain(0);
+
+	unique_lock<mutex> guard(lock);
+	finished.wait(guard, [this] { return busy == 0; });
+	job = NULL;
+}
+
+void TileScheduler::WorkerLoop(int index) {
+	int seen = 0;
+	while (true) {
+		{
+			unique_lock<mutex> guard(lock);
+			wake.wait(guard, [&] { return quit || generation != seen; });
+			if (quit)
+				return;
+			seen = generation;
+		}
+
+		Drain(index);
+
+		lock_guard<mutex> guard(lock);
+		if (--busy == 0)
+			finished.notify_all();
+	}
+}
+
+// Works through this thread's deque, then steals until every deque is empty.
+void TileScheduler::Drain(int index) {
+	Tile tile;
+	while (Pop(index, &tile) || Steal(index, &tile)) {
+		(*job)(tile);
+	}
+}
+
+bool TileScheduler::Pop(int index, Tile* tile) {
+	Queue& queue = *queues[index];
+	lock_guard<mutex> guard(queue.lock);
+	if (queue.tiles.empty())
+		return false;
+	*tile = queue.tiles.front();
+	queue.tiles.pop_front();
+	return true;
+}
+
+bool TileScheduler::Steal(int index, Tile* tile) {
+	int count = queues.size();
+	for (int i = 1; i < count; i++) {
+		Queue& victim = *queues[(index + i) % count];
+		lock_guard<mutex> guard(victim.lock);
+		if (victim.tiles.empty())
+			continue;
+		*tile = victim.tiles.back();
+		victim.tiles.pop_back();
+		steals++;
+		return true;
+	}
+	return false;
+}
+
+}  // namespace Raytracer
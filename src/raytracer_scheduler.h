@@ -0,0 +1,72 @@
+#ifndef _RAYTRACER_SCHEDULER_H
+#define _RAYTRACER_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Side of a square tile in pixels. A multiple of PACKET_W and PACKET_H so packets never straddle tiles.
+#define TILE_SIZE 16
+
+namespace Raytracer {
+
+using namespace std;
+
+// Pixels [x0, x1) x [y0, y1) of the image, rendered by one thread.
+struct Tile {
+	int x0, y0, x1, y1;
+};
+
+// Splits an image into tiles and renders them on threads that stay alive between renders.
+// Tiles are ordered along a Morton curve and dealt to the threads in contiguous runs, one deque each,
+// so a thread works through a compact patch of the image. A thread that runs out steals from the back
+// of another thread's deque, which is the part its owner would have reached last.
+struct TileScheduler {
+	// Tiles taken from another thread's deque during the last Run().
+	atomic<int> steals{0};
+
+	~TileScheduler();
+
+	// Calls work on every tile of a width x height image from threads threads, the calling one included,
+	// and returns once all of them are done. The pool is only rebuilt when threads changes.
+	void Run(int width, int height, int threads, const function<void(const Tile&)>& work);
+	int ThreadCount() const { return workers.size() + 1; }
+
+  private:
+	struct Queue {
+		mutex lock;
+		deque<Tile> tiles;
+	};
+
+	vector<thread> workers;
+	vector<unique_ptr<Queue>> queues;
+	const function<void(const Tile&)>* job = NULL;
+
+	// Guards the fields below, which hand each render to the workers.
+	mutex lock;
+	condition_variable wake;
+	condition_variable finished;
+	int generation = 0;
+	int busy = 0;
+	bool quit = false;
+	// Only one render uses the pool at a time.
+	mutex run_lock;
+
+	void Resize(int threads);
+	void WorkerLoop(int index);
+	void Drain(int index);
+	bool Pop(int index, Tile* tile);
+	bool Steal(int index, Tile* tile);
+};
+
+// Render threads: all hardware threads reported by the system, at least one.
+int HardwareThreads();
+
+}  // namespace Raytracer
+
+#endif
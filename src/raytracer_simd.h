@@ -0,0 +1,100 @@
+#ifndef _RAYTRACER_SIMD_H
+#define _RAYTRACER_SIMD_H
+
+// Width of vfloat, picked from the instruction set the compiler targets:
+// AVX2 (/arch:AVX2, -mavx2) gives 8 lanes, SSE2 (any x64 build) 4, anything else falls back to 1.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+#else
+#define SIMD_WIDTH 1
+#endif
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SIMD_ALIGN alignas(SIMD_WIDTH * 4)
+
+// SIMD_WIDTH floats operated on together. Comparisons return masks, turned into lane bits by Bits().
+struct vfloat {
+#if SIMD_WIDTH == 8
+    __m256 v;
+    vfloat(__m256 v) : v(v) {}
+    vfloat(float f) : v(_mm256_set1_ps(f)) {}
+    static vfloat Load(const float* p) { return _mm256_load_ps(p); }
+    // Widens 8 bytes to floats.
+    static vfloat FromBytes(const uint8_t* p) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p)));
+    }
+    void Store(float* p) const { _mm256_store_ps(p, v); }
+    int Bits() const { return _mm256_movemask_ps(v); }
+#elif SIMD_WIDTH == 4
+    __m128 v;
+    vfloat(__m128 v) : v(v) {}
+    vfloat(float f) : v(_mm_set1_ps(f)) {}
+    static vfloat Load(const float* p) { return _mm_load_ps(p); }
+    // Widens 4 bytes to floats.
+    static vfloat FromBytes(const uint8_t* p) {
+        int bytes;
+        memcpy(&bytes, p, 4);
+        __m128i zero = _mm_setzero_si128();
+        __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+        return _mm_cvtepi32_ps(wide);
+    }
+    void Store(float* p) const { _mm_store_ps(p, v); }
+    int Bits() const { return _mm_movemask_ps(v); }
+#else
+    float v;
+    vfloat(float f) : v(f) {}
+    static vfloat Load(const float* p) { return *p; }
+    static vfloat FromBytes(const uint8_t* p) { return (float)*p; }
+    void Store(float* p) const { *p = v; }
+    // Masks are stored as -1 / 0 in the scalar fallback.
+    int Bits() const { return v != 0 ? 1 : 0; }
+#endif
+    vfloat() {}
+};
+
+#if SIMD_WIDTH == 8
+inline vfloat operator+(vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a.v, b.v); }
+inline vfloat operator<=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline vfloat operator>=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a.v); }
+inline vfloat operator&(vfloat a, vfloat b) { return _mm256_and_ps(a.v, b.v); }
+inline vfloat operator|(vfloat a, vfloat b) { return _mm256_or_ps(a.v, b.v); }
+#elif SIMD_WIDTH == 4
+inline vfloat operator+(vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a.v, b.v); }
+inline vfloat operator<=(vfloat a, vfloat b) { return _mm_cmple_ps(a.v, b.v); }
+inline vfloat operator>=(vfloat a, vfloat b) { return _mm_cmpge_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a.v); }
+inline vfloat operator&(vfloat a, vfloat b) { return _mm_and_ps(a.v, b.v); }
+inline vfloat operator|(vfloat a, vfloat b) { return _mm_or_ps(a.v, b.v); }
+#else
+inline vfloat operator+(vfloat a, vfloat b) { return a.v + b.v; }
+inline vfloat operator-(vfloat a, vfloat b) { return a.v - b.v; }
+inline vfloat operator*(vfloat a, vfloat b) { return a.v * b.v; }
+inline vfloat vmin(vfloat a, vfloat b) { return fminf(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return fmaxf(a.v, b.v); }
+inline vfloat operator<=(vfloat a, vfloat b) { return a.v <= b.v ? -1.0f : 0.0f; }
+inline vfloat operator>=(vfloat a, vfloat b) { return a.v >= b.v ? -1.0f : 0.0f; }
+inline vfloat operator/(vfloat a, vfloat b) { return a.v / b.v; }
+inline vfloat vsqrt(vfloat a) { return sqrtf(a.v); }
+inline vfloat operator&(vfloat a, vfloat b) { return (a.v != 0 && b.v != 0) ? -1.0f : 0.0f; }
+inline vfloat operator|(vfloat a, vfloat b) { return (a.v != 0 || b.v != 0) ? -1.0f : 0.0f; }
+#endif
+
+#endif
@@ -15,14 +15,6 @@ namespace Raytracer {
 
 #define ImGuiStr(name) WithId(name).c_str()
 
-void Camera::PreRender() {
-	mid_res = vec3i(res.x / 2, res.y / 2, 0);
-
-	forward = forward.normalized();
-	right = cross(forward, up).normalized();
-	up = cross(right, forward).normalized();
-}
-
 // assumes normalized
 void ForwardUpToMatrix(float* mat, vec3& forward, vec3& up) {
     vec3 right = cross(forward, up);
@@ -57,10 +49,10 @@ void Camera::ImGui() {
         float viewManipulateTop = ImGui::GetWindowPos().y + ImGui::GetItemRectMax().y - ImGui::GetWindowPos().y;
         updated |= ImGuizmo::ViewManipulate(cameraView, cameraDistance, ImVec2(viewManipulateRight - 128, viewManipulateTop), ImVec2(128, 128), 0x10101010);
         MatrixToForwardUp(cameraView, forward, up);
-        ImGui::DragDoubleN("camera_forward", &forward.x, 3, 0.0, 0.0, 0.0, "%.2f", ImGuiSliderFlags_NoInput);
-        ImGui::DragDoubleN("camera_up", &up.x, 3, 0.0, 0.0, 0.0, "%.2f", ImGuiSliderFlags_NoInput);
+        ImGui::DragVec3("camera_forward", &forward, 0.0, 0.0, 0.0, "%.2f", ImGuiSliderFlags_NoInput);
+        ImGui::DragVec3("camera_up", &up, 0.0, 0.0, 0.0, "%.2f", ImGuiSliderFlags_NoInput);
 
-        updated |= ImGui::DragDoubleN("Camera Pos", &position.x, 3);
+        updated |= ImGui::DragVec3("Camera Pos", &position);
         updated |= ImGui::SliderFloat("FOV", &half_vfov, 0.0, 180.0);
         updated |= ImGui::DragInt2("Resolution", &res.x, 1);
         updated |= ImGui::SliderInt("Max Depth", &max_depth, 1, 8);
@@ -77,7 +69,7 @@ void Geometry::ImGui() {
         if (ImGui::Button(ImGuiStr("Sphere"))) {
             auto iter = GetIter(this);
             Geometry* old = *iter;
-            *iter = new Sphere(id, materials.back());
+            *iter = new Sphere(id, material);
             delete old;
         }
         if (ImGui::Button(ImGuiStr("Delete##"))) {
@@ -87,14 +79,26 @@ void Geometry::ImGui() {
     ImGui::Unindent(TAB_SIZE);
 }
 
+// Edits a copy of the material, so the other shapes sharing it keep theirs, and interns whatever it became.
+void Geometry::MaterialImGui() {
+    Material edited = *material;
+    ImGui::PushID(this);
+    edited.ImGui();
+    ImGui::PopID();
+    if (!edited.Matches(*material)) {
+        material = InternMaterial(edited);
+        PruneMaterials();
+    }
+}
+
 void Sphere::ImGui() {
 	bool updated = false;
     ImGui::Indent(TAB_SIZE);
     if (ImGui::CollapsingHeader(ImGuiStr("Sphere "))) {
-        updated |= ImGui::DragDoubleN(ImGuiStr("pos##"), &position.x, 3);
+        updated |= ImGui::DragVec3(ImGuiStr("pos##"), &position);
         updated |= ImGui::DragFloat(ImGuiStr("radius##"), &radius, 0.01, 0.01);
         ImGui::Indent(3.0);
-        material->ImGui();
+        MaterialImGui();
         ImGui::Unindent(3.0);
         if (ImGui::Button(ImGuiStr("Delete##"))) {
             Delete(this);
@@ -108,11 +112,11 @@ void Triangle::ImGui() {
 	bool updated = false;
 	ImGui::Indent(TAB_SIZE);
 	if (ImGui::CollapsingHeader(ImGuiStr("Triangle "))) {
-		updated |= ImGui::DragDoubleN(ImGuiStr("pos1##"), &v1.x, 3, 0.05);
-		updated |= ImGui::DragDoubleN(ImGuiStr("pos2##"), &v2.x, 3, 0.05);
-		updated |= ImGui::DragDoubleN(ImGuiStr("pos3##"), &v3.x, 3, 0.05);
+		updated |= ImGui::DragVec3(ImGuiStr("pos1##"), &v1, 0.05);
+		updated |= ImGui::DragVec3(ImGuiStr("pos2##"), &v2, 0.05);
+		updated |= ImGui::DragVec3(ImGuiStr("pos3##"), &v3, 0.05);
         ImGui::Indent(3.0);
-        material->ImGui();
+        MaterialImGui();
         ImGui::Unindent(3.0);
         if (ImGui::Button(ImGuiStr("Delete##"))) {
             Delete(this);
@@ -126,15 +130,76 @@ void NormalTriangle::ImGui() {
 	bool updated = false;
 	ImGui::Indent(TAB_SIZE);
 	if (ImGui::CollapsingHeader(ImGuiStr("NormTriangle "))) {
-		updated |= ImGui::DragDoubleN(ImGuiStr("pos1##"), &v1.x, 3, 0.05);
-		updated |= ImGui::DragDoubleN(ImGuiStr("pos2##"), &v2.x, 3, 0.05);
-		updated |= ImGui::DragDoubleN(ImGuiStr("pos3##"), &v3.x, 3, 0.05);
-		updated |= ImGui::DragDoubleN(ImGuiStr("norm1##"), &n1.x, 3, 0.05);
-		updated |= ImGui::DragDoubleN(ImGuiStr("norm2##"), &n2.x, 3, 0.05);
-		updated |= ImGui::DragDoubleN(ImGuiStr("norm3##"), &n3.x, 3, 0.05);
+		updated |= ImGui::DragVec3(ImGuiStr("pos1##"), &v1, 0.05);
+		updated |= ImGui::DragVec3(ImGuiStr("pos2##"), &v2, 0.05);
+		updated |= ImGui::DragVec3(ImGuiStr("pos3##"), &v3, 0.05);
+		updated |= ImGui::DragVec3(ImGuiStr("norm1##"), &n1, 0.05);
+		updated |= ImGui::DragVec3(ImGuiStr("norm2##"), &n2, 0.05);
+		updated |= ImGui::DragVec3(ImGuiStr("norm3##"), &n3, 0.05);
+        ImGui::Indent(3.0);
+        MaterialImGui();
+        ImGui::Unindent(3.0);
+        if (ImGui::Button(ImGuiStr("Delete##"))) {
+            Delete(this);
+        }
+	}
+	ImGui::Unindent(TAB_SIZE);
+	if (updated) RequestRender();
+}
+
+void Mesh::ImGui() {
+	ImGui::Indent(TAB_SIZE);
+	if (ImGui::CollapsingHeader(ImGuiStr("Mesh "))) {
+		ImGui::Text("%d triangles%s", TriangleCount(), smooth ? ", smooth" : "");
+        ImGui::Indent(3.0);
+        MaterialImGui();
+        ImGui::Unindent(3.0);
+        if (ImGui::Button(ImGuiStr("Delete##"))) {
+            Delete(this);
+        }
+	}
+	ImGui::Unindent(TAB_SIZE);
+}
+
+void SphereCloud::ImGui() {
+	bool updated = false;
+	ImGui::Indent(TAB_SIZE);
+	if (ImGui::CollapsingHeader(ImGuiStr("Sphere Cloud "))) {
+		ImGui::Text("%d spheres", SphereCount());
         ImGui::Indent(3.0);
-        material->ImGui();
+        MaterialImGui();
         ImGui::Unindent(3.0);
+		if (ImGui::TreeNode(ImGuiStr("Spheres##"))) {
+			// Only the rows in view are built, clouds can hold millions of spheres.
+			ImGuiListClipper clipper;
+			clipper.Begin(SphereCount());
+			while (clipper.Step()) {
+				for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+					ImGui::PushID(i);
+					updated |= ImGui::DragVec3("pos", &centers[i]);
+					updated |= ImGui::DragFloat("radius", &radii[i], 0.01, 0.01);
+					ImGui::PopID();
+				}
+			}
+			ImGui::TreePop();
+		}
+        if (ImGui::Button(ImGuiStr("Delete##"))) {
+            Delete(this);
+        }
+	}
+	ImGui::Unindent(TAB_SIZE);
+	if (updated) RequestRender();
+}
+
+// The shapes of the prototype aren't editable here, every instance of it would change with them.
+void Instance::ImGui() {
+	bool updated = false;
+	ImGui::Indent(TAB_SIZE);
+	if (ImGui::CollapsingHeader(ImGuiStr("Instance "))) {
+		ImGui::Text("of %s", prototype->name.c_str());
+		updated |= ImGui::DragVec3(ImGuiStr("pos##"), &position, 0.05);
+		updated |= ImGui::DragVec3(ImGuiStr("rot##"), &rotation, 1.0);
+		updated |= ImGui::DragFloat(ImGuiStr("scale##"), &scale, 0.01, 0.01, 100.0);
         if (ImGui::Button(ImGuiStr("Delete##"))) {
             Delete(this);
         }
@@ -145,14 +210,16 @@ void NormalTriangle::ImGui() {
 
 void Material::ImGui() {
 	bool updated = false;
-    if (ImGui::CollapsingHeader(ImGuiStr("Material "))) {
+    // Labels leave out the id: editing moves a shape to another material, and the widgets have to stay the
+    // same ones while it does. The shape pushes its own ID instead.
+    if (ImGui::CollapsingHeader("Material")) {
         ImGui::Indent(4.0);
-        updated |= ImGui::ColorEdit3(ImGuiStr("ambient##"), &ambient.r);
-        updated |= ImGui::ColorEdit3(ImGuiStr("diffuse##"), &diffuse.r);
-        updated |= ImGui::ColorEdit3(ImGuiStr("specular##"), &specular.r);
-        updated |= ImGui::ColorEdit3(ImGuiStr("transmissive##"), &transmissive.r);
-        updated |= ImGui::DragFloat(ImGuiStr("phong##"), &phong, 1, 2.0, 128.0, "%.1f", ImGuiSliderFlags_Logarithmic);
-        updated |= ImGui::DragFloat(ImGuiStr("ior##"), &ior, 0.1f);
+        updated |= ImGui::ColorEdit3("ambient", &ambient.r);
+        updated |= ImGui::ColorEdit3("diffuse", &diffuse.r);
+        updated |= ImGui::ColorEdit3("specular", &specular.r);
+        updated |= ImGui::ColorEdit3("transmissive", &transmissive.r);
+        updated |= ImGui::DragFloat("phong", &phong, 1, 2.0, 128.0, "%.1f", ImGuiSliderFlags_Logarithmic);
+        updated |= ImGui::DragFloat("ior", &ior, 0.1f);
         ImGui::Unindent(4.0);
     }
 	if (updated) RequestRender();
@@ -186,7 +253,7 @@ void PointLight::ImGui() {
     bool updated = false;
     ImGui::Indent(TAB_SIZE);
     if (ImGui::CollapsingHeader(ImGuiStr("Point "))) {
-        updated |= ImGui::DragDoubleN(ImGuiStr("position##"), &position.x, 3);
+        updated |= ImGui::DragVec3(ImGuiStr("position##"), &position);
         updated |= ImGui::DragFloat(ImGuiStr("Multiplier##"), &mult, 0.05, 0.01, 1000.0);
         updated |= ImGui::ColorEdit3(ImGuiStr("color##"), &color.r);
         if (ImGui::Button(ImGuiStr("Delete##"))) {
@@ -201,8 +268,8 @@ void SpotLight::ImGui() {
     bool updated = false;
     ImGui::Indent(TAB_SIZE);
     if (ImGui::CollapsingHeader(ImGuiStr("Spot "))) {
-        updated |= ImGui::DragDoubleN(ImGuiStr("position##"), &position.x, 3);
-        updated |= ImGui::DragDoubleN(ImGuiStr("direction##"), &direction.x, 3, 0.01, -1, 1);
+        updated |= ImGui::DragVec3(ImGuiStr("position##"), &position);
+        updated |= ImGui::DragVec3(ImGuiStr("direction##"), &direction, 0.01, -1, 1);
         updated |= ImGui::SliderFloat(ImGuiStr("interior_angle##"), &angle1, 0, 90);
         angle2 = max(angle1, angle2);
         updated |= ImGui::SliderFloat(ImGuiStr("exterior_angle##"), &angle2, angle1, 90);
@@ -222,7 +289,7 @@ void DirectionalLight::ImGui() {
     ImGui::Indent(TAB_SIZE);
     if (ImGui::CollapsingHeader(ImGuiStr("Directional "))) {
         updated |= ImGui::DragFloat(ImGuiStr("Multiplier"), &mult, 0.05, 0.01);
-        updated |= ImGui::DragDoubleN(ImGuiStr("direction##"), &direction.x, 3, 0.05, -1.0, 1.0);
+        updated |= ImGui::DragVec3(ImGuiStr("direction##"), &direction, 0.05, -1.0, 1.0);
         updated |= ImGui::ColorEdit3(ImGuiStr("color##"), &color.r);
         if (ImGui::Button(ImGuiStr("Delete##"))) {
             Delete(this);
@@ -234,59 +301,59 @@ void DirectionalLight::ImGui() {
 }
 
 
-// From Dear ImGui wiki
-bool LoadTextureFromFile(const char* filename, GLuint* out_texture, int* out_width, int* out_height) {
-    // Load from file
-    int image_width = 0;
-    int image_height = 0;
-    unsigned char* image_data = stbi_load(filename, &image_width, &image_height, NULL, 4);
-    if (image_data == NULL)
-        return false;
-
-    // Create a OpenGL texture identifier
-    GLuint image_texture;
-    glGenTextures(1, &image_texture);
-    glBindTexture(GL_TEXTURE_2D, image_texture);
-
-    // Setup filtering parameters for display
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
-        GL_CLAMP_TO_EDGE);  // This is required on WebGL for non power-of-two textures
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);  // Same
-
-    // Upload pixels into texture
+// Converts to the RGBA8 layout of the display texture, clamping like Image::toBytes().
+static void ToRGBA8(Image& image, uint8_t* out) {
+    for (int j = 0; j < image.height; j++) {
+        for (int i = 0; i < image.width; i++) {
+            Color col = image.getPixel(i, j);
+            uint8_t* px = out + 4 * (i + j * image.width);
+            px[0] = uint8_t(fmin(col.r, 1) * 255);
+            px[1] = uint8_t(fmin(col.g, 1) * 255);
+            px[2] = uint8_t(fmin(col.b, 1) * 255);
+            px[3] = 255;
+        }
+    }
+}
+
+// The texture is only reallocated when the size changes. Pixels go through a pixel buffer object so
+// glTexSubImage2D copies from driver memory; the buffer is orphaned every upload so the driver never has
+// to wait for the previous one.
+void DisplayImage(Image& image) {
+    if (disp_img_tex == -1) {
+        glGenTextures(1, &disp_img_tex);
+        glBindTexture(GL_TEXTURE_2D, disp_img_tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glGenBuffers(1, &disp_img_pbo);
+    }
+    glBindTexture(GL_TEXTURE_2D, disp_img_tex);
 #if defined(GL_UNPACK_ROW_LENGTH) && !defined(__EMSCRIPTEN__)
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 #endif
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image_width, image_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image_data);
-    stbi_image_free(image_data);
-
-    *out_texture = image_texture;
-    *out_width = image_width;
-    *out_height = image_height;
-
-    return true;
-}
-
-
-void DisplayImage(string name) {
-    int im_x, im_y;
-    bool ret = LoadTextureFromFile(name.c_str(), &disp_img_tex, &im_x, &im_y);
-    disp_img_size = ImVec2(im_x, im_y);
-    IM_ASSERT(ret);
-}
+    if (disp_img_size.x != image.width || disp_img_size.y != image.height) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        disp_img_size = ImVec2(image.width, image.height);
+    }
 
-void Log(string s) {
-    debug_log.push_back(s);
-    if (debug_log.size() > 100) {
-        debug_log.erase(debug_log.begin(), debug_log.begin() + 20);
+    GLsizeiptr size = image.width * image.height * 4;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, disp_img_pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    uint8_t* bytes = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (bytes != NULL) {
+        ToRGBA8(image, bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        // With a buffer bound the last argument is an offset into it.
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width, image.height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
     }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
 void DisplayLog() {
     ImGui::Checkbox("Show Debug Log", &print_debug);
     ImGui::SameLine();
+    lock_guard<mutex> guard(debug_log_lock);
     if (ImGui::Button("Clear")) debug_log.clear();
     if (print_debug) {
         ImGui::BeginChild("Log");
@@ -0,0 +1,296 @@
+#include "raytracer_wavefront.h"
+
+#include <algorithm>
+#include <cmath>
+#include "raytracer_render.h"
+
+namespace Raytracer {
+
+WavefrontStats wavefront_stats;
+
+void WavefrontStats::Reset() {
+    for (int i = 0; i < WAVEFRONT_STAGES; i++) {
+        rays[i] = 0;
+        ns[i] = 0;
+    }
+}
+
+string WavefrontStats::Summary() const {
+    static const char* names[WAVEFRONT_STAGES] = {"generate", "intersect", "shade", "shadow", "sort"};
+    string s = "wavefront rays/sec per thread:";
+    for (int i = 0; i < WAVEFRONT_STAGES; i++) {
+        double seconds = ns[i].load() * 1e-9;
+        s += string(i > 0 ? "," : "") + " " + names[i] + " " + to_string((long long)(rays[i] / fmax(seconds, 1e-9)));
+    }
+    return s;
+}
+
+// A ray waiting to be intersected.
+struct QueuedRay {
+    Ray ray;
+    // Product of the reflection and transmission weights from the camera to this ray.
+    Color throughput;
+    // Index of the sample its light is added to.
+    int sample;
+    // Hits between the camera and the ray's origin.
+    int depth;
+};
+
+struct QueuedHit {
+    HitInformation hit;
+    Color throughput;
+    int sample;
+    int depth;
+    int bounces_left;
+};
+
+struct ShadowRay {
+    Ray ray;
+    float t_max;
+    // Diffuse and specular light added to the sample if nothing blocks the ray.
+    Color light;
+    int sample;
+};
+
+// Queues of one render thread. Kept between tiles, so they stop allocating once they've grown.
+struct Wavefront {
+    vector<QueuedRay> rays;
+    vector<QueuedHit> hits;
+    vector<ShadowRay> shadows;
+    vector<QueuedRay> secondary;
+    // Sort key and index of every secondary ray.
+    vector<pair<uint64_t, int>> keys;
+    // Color of every sample being traced.
+    vector<Color> samples;
+
+    // Counted here and added to wavefront_stats once per tile.
+    long long stage_rays[WAVEFRONT_STAGES] = {};
+    long long stage_ns[WAVEFRONT_STAGES] = {};
+};
+
+thread_local Wavefront wavefront_queues;
+
+// Counts rays into stage and the time since start, then restarts start for the next stage.
+static void EndStage(Wavefront& wf, WavefrontStage stage, size_t rays, steady_clock::time_point* start) {
+    steady_clock::time_point now = steady_clock::now();
+    wf.stage_rays[stage] += rays;
+    wf.stage_ns[stage] += duration_cast<nanoseconds>(now - *start).count();
+    *start = now;
+}
+
+static void QueueCameraRay(const SceneSnapshot& scene, Wavefront& wf, const Ray& ray, int sample) {
+    wf.samples[sample] = Color(0, 0, 0);
+    if (ray.bounces_left <= 0)
+        wf.samples[sample] = scene.camera.background_color;
+    else
+        wf.rays.push_back(QueuedRay{ray, Color(1, 1, 1), sample, 0});
+}
+
+// A ray that missed adds the background, one that hit goes on to be shaded.
+static void Resolve(const SceneSnapshot& scene, Wavefront& wf, const QueuedRay& queued, bool found, const HitInformation& hit) {
+    if (found) {
+        wf.hits.push_back(QueuedHit{hit, queued.throughput, queued.sample, queued.depth, queued.ray.bounces_left});
+    } else {
+        Color& sample = wf.samples[queued.sample];
+        sample = sample + queued.throughput * scene.camera.background_color;
+    }
+}
+
+static void Intersect(const SceneSnapshot& scene, Wavefront& wf) {
+    wf.hits.clear();
+#if PACKET_TRACING
+    for (size_t first = 0; first < wf.rays.size(); first += SIMD_WIDTH) {
+        int lanes = (int)min((size_t)SIMD_WIDTH, wf.rays.size() - first);
+        RayPacket packet;
+        packet.active = (1 << lanes) - 1;
+        for (int lane = 0; lane < lanes; lane++) {
+            packet.rays[lane] = wf.rays[first + lane].ray;
+        }
+        packet.Prepare();
+
+        HitInformation hits[SIMD_WIDTH];
+        int hit_mask = FindIntersection(scene, packet, hits);
+        for (int lane = 0; lane < lanes; lane++) {
+            Resolve(scene, wf, wf.rays[first + lane], (hit_mask & (1 << lane)) != 0, hits[lane]);
+        }
+    }
+#else
+    for (const QueuedRay& queued : wf.rays) {
+        HitInformation hit;
+        bool found = FindIntersection(scene, queued.ray, &hit);
+        Resolve(scene, wf, queued, found, hit);
+    }
+#endif
+}
+
+// Queues a reflected or refracted ray of parent weighted by weight. Rays that can't add anything are dropped,
+// and rays out of bounces add the background right away, the same as in ApplyLighting().
+static void Spawn(const SceneSnapshot& scene, Wavefront& wf, const QueuedHit& parent, const Ray& ray, const Color& weight) {
+    Color throughput = parent.throughput * weight;
+    if (throughput.r == 0 && throughput.g == 0 && throughput.b == 0)
+        return;
+    if (ray.bounces_left <= 0 || parent.depth + 1 == MAX_PATH_DEPTH) {
+        Color& sample = wf.samples[parent.sample];
+        sample = sample + throughput * scene.camera.background_color;
+        return;
+    }
+    wf.secondary.push_back(QueuedRay{ray, throughput, parent.sample, parent.depth + 1});
+}
+
+static void Shade(const SceneSnapshot& scene, Wavefront& wf) {
+    wf.shadows.clear();
+    wf.secondary.clear();
+    for (const QueuedHit& queued : wf.hits) {
+        const HitInformation& hit = queued.hit;
+        const Material* material = hit.material;
+        Color& sample = wf.samples[queued.sample];
+        sample = sample + queued.throughput * CalculateAmbient(scene, hit);
+
+        for (const LightChoice& choice : SelectLights(scene, hit)) {
+            Light* light = choice.light;
+            if (light->Intensity(hit.pos) < Color(0.001, 0.001, 0.001))
+                continue;
+            Color light_color = CalculateDiffuse(light, hit) * choice.weight + CalculateSpecular(light, hit) * choice.weight;
+            // Not worth a shadow ray if it couldn't add anything.
+            Color contribution = queued.throughput * light_color;
+            if (contribution.r == 0 && contribution.g == 0 && contribution.b == 0)
+                continue;
+            wf.shadows.push_back(ShadowRay{light->ReverseLightRay(hit.pos), sqrtf(light->DistanceTo2(hit.pos)), contribution, queued.sample});
+        }
+
+        Ray reflected = Ray::Reflect(-hit.viewing, hit.pos, hit.normal, queued.bounces_left - 1);
+        reflected.last_material = hit.material;
+        Spawn(scene, wf, queued, reflected, material->specular);
+
+        Color t = material->transmissive;
+        if (t.r + t.g + t.b > 0) {
+            Ray refracted = Ray::Refract(hit.viewing, hit.pos, hit.normal, material->ior, queued.bounces_left - 1);
+            refracted.last_material = hit.material;
+            if (refracted.bounces_left != -1)
+                Spawn(scene, wf, queued, refracted, t);
+        }
+    }
+}
+
+static void TraceShadows(const SceneSnapshot& scene, Wavefront& wf) {
+    for (const ShadowRay& shadow : wf.shadows) {
+        if (Occluded(scene, shadow.ray, shadow.t_max))
+            continue;
+        Color& sample = wf.samples[shadow.sample];
+        sample = sample + shadow.light;
+    }
+}
+
+// Spreads the low 10 bits of x out to every third bit.
+static uint32_t SpreadBits3(uint32_t x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// Moves the secondary rays into the intersect queue, grouped by direction octant and, within an octant,
+// ordered along a Morton curve through the bounds of their origins.
+static void SortSecondary(Wavefront& wf) {
+    const vector<QueuedRay>& rays = wf.secondary;
+    wf.rays.clear();
+    if (rays.empty())
+        return;
+
+    vec3 lo = rays[0].ray.pos, hi = lo;
+    for (const QueuedRay& queued : rays) {
+        const vec3& p = queued.ray.pos;
+        lo = vec3(fmin(lo.x, p.x), fmin(lo.y, p.y), fmin(lo.z, p.z));
+        hi = vec3(fmax(hi.x, p.x), fmax(hi.y, p.y), fmax(hi.z, p.z));
+    }
+    vec3 extent = hi - lo;
+    // 1023.99 rather than 1024 keeps the far edge on the last cell.
+    float sx = extent.x > 0 ? 1023.99f / extent.x : 0;
+    float sy = extent.y > 0 ? 1023.99f / extent.y : 0;
+    float sz = extent.z > 0 ? 1023.99f / extent.z : 0;
+
+    wf.keys.clear();
+    for (int i = 0; i < (int)rays.size(); i++) {
+        const Ray& ray = rays[i].ray;
+        uint64_t octant = (ray.dir.x < 0) | ((ray.dir.y < 0) << 1) | ((ray.dir.z < 0) << 2);
+        uint32_t morton = SpreadBits3((uint32_t)((ray.pos.x - lo.x) * sx)) |
+                          (SpreadBits3((uint32_t)((ray.pos.y - lo.y) * sy)) << 1) |
+                          (SpreadBits3((uint32_t)((ray.pos.z - lo.z) * sz)) << 2);
+        wf.keys.push_back({(octant << 30) | morton, i});
+    }
+    sort(wf.keys.begin(), wf.keys.end());
+    for (const pair<uint64_t, int>& key : wf.keys) {
+        wf.rays.push_back(rays[key.second]);
+    }
+}
+
+// Traces the rays queued in wf.rays and everything they spawn, adding their light to wf.samples.
+static void TraceQueued(const SceneSnapshot& scene, Wavefront& wf, steady_clock::time_point start) {
+    while (!wf.rays.empty()) {
+        Intersect(scene, wf);
+        EndStage(wf, WAVEFRONT_INTERSECT, wf.rays.size(), &start);
+        Shade(scene, wf);
+        EndStage(wf, WAVEFRONT_SHADE, wf.hits.size(), &start);
+        TraceShadows(scene, wf);
+        EndStage(wf, WAVEFRONT_SHADOW, wf.shadows.size(), &start);
+        SortSecondary(wf);
+        EndStage(wf, WAVEFRONT_SORT, wf.secondary.size(), &start);
+    }
+
+    for (int i = 0; i < WAVEFRONT_STAGES; i++) {
+        wavefront_stats.rays[i] += wf.stage_rays[i];
+        wavefront_stats.ns[i] += wf.stage_ns[i];
+        wf.stage_rays[i] = 0;
+        wf.stage_ns[i] = 0;
+    }
+}
+
+void TraceTileWavefront(const SceneSnapshot& scene, const Tile& tile, int first, int count, Color* sums) {
+    Wavefront& wf = wavefront_queues;
+    steady_clock::time_point start = steady_clock::now();
+    int width = tile.x1 - tile.x0;
+    int pixels = width * (tile.y1 - tile.y0);
+    // The samples of a pixel are next to each other, so they share packets.
+    wf.samples.resize(pixels * count);
+    wf.rays.clear();
+    for (int i = 0; i < pixels; i++) {
+        int x = tile.x0 + i % width, y = tile.y0 + i / width;
+        for (int samp_i = 0; samp_i < count; samp_i++) {
+            QueueCameraRay(scene, wf, CameraRay(scene, x, y, SampleOffsetAt(x, y, first + samp_i)), i * count + samp_i);
+        }
+    }
+    EndStage(wf, WAVEFRONT_GENERATE, pixels * count, &start);
+
+    TraceQueued(scene, wf, start);
+
+    for (int i = 0; i < pixels; i++) {
+        Color& sum = sums[(tile.y0 + i / width) * scene.camera.res.x + tile.x0 + i % width];
+        for (int samp_i = 0; samp_i < count; samp_i++) {
+            Color new_color = wf.samples[i * count + samp_i];
+            new_color.Clamp();
+            sum = sum + new_color;
+        }
+    }
+}
+
+void TracePixelWavefront(const SceneSnapshot& scene, int x, int y, int first, int count, Color* colors) {
+    Wavefront& wf = wavefront_queues;
+    steady_clock::time_point start = steady_clock::now();
+    wf.samples.resize(count);
+    wf.rays.clear();
+    for (int samp_i = 0; samp_i < count; samp_i++) {
+        QueueCameraRay(scene, wf, CameraRay(scene, x, y, SampleOffsetAt(x, y, first + samp_i)), samp_i);
+    }
+    EndStage(wf, WAVEFRONT_GENERATE, count, &start);
+
+    TraceQueued(scene, wf, start);
+
+    for (int samp_i = 0; samp_i < count; samp_i++) {
+        colors[samp_i] = wf.samples[samp_i];
+        colors[samp_i].Clamp();
+    }
+}
+
+}  // namespace Raytracer
@@ -0,0 +1,57 @@
+#ifndef _RAYTRACER_WAVEFRONT_H
+#define _RAYTRACER_WAVEFRONT_H
+
+#include <atomic>
+#include <string>
+#include "raytracer_ray.h"
+#include "raytracer_scheduler.h"
+
+using namespace std;
+
+namespace Raytracer {
+
+struct SceneSnapshot;
+
+// Wavefront tracing, the alternative to EvaluateRay() picked by the wavefront setting. Instead of following
+// one path to the end before starting the next, every ray of a tile goes through one stage at a time:
+//   generate   camera rays for every sample of every pixel
+//   intersect  the whole queue, SIMD_WIDTH rays to a packet under PACKET_TRACING
+//   shade      ambient light, plus a shadow ray per light and the reflected and refracted rays per hit
+//   shadow     the shadow rays, adding the light of those that get through
+//   sort       the reflected and refracted rays, by direction octant then along a Morton curve of their
+//              origins, so neighbors in the next intersect queue walk the same part of the accelerator
+// and the secondary rays loop back to intersect until none are left. A ray's weight rides along with it and
+// what it finds is added straight to its sample, so nothing waits on its children.
+//
+// Adds up the same terms as ApplyLighting(), in a different order, so images match the recursive path to
+// within float rounding.
+enum WavefrontStage {
+    WAVEFRONT_GENERATE,
+    WAVEFRONT_INTERSECT,
+    WAVEFRONT_SHADE,
+    WAVEFRONT_SHADOW,
+    WAVEFRONT_SORT,
+    WAVEFRONT_STAGES
+};
+
+// Rays through and time spent in each stage, summed over the render threads.
+struct WavefrontStats {
+    atomic<long long> rays[WAVEFRONT_STAGES];
+    atomic<long long> ns[WAVEFRONT_STAGES];
+
+    WavefrontStats() { Reset(); }
+    void Reset();
+    // Rays/sec of every stage, per thread as the times are summed over the threads.
+    string Summary() const;
+};
+
+extern WavefrontStats wavefront_stats;
+
+// Adds samples [first, first + count) of every pixel in the tile to sums, a camera.res sized row-major buffer.
+void TraceTileWavefront(const SceneSnapshot& scene, const Tile& tile, int first, int count, Color* sums);
+// Colors of samples [first, first + count) of pixel (x, y), clamped like the ones added to sums.
+void TracePixelWavefront(const SceneSnapshot& scene, int x, int y, int first, int count, Color* colors);
+
+}  // namespace Raytracer
+
+#endif
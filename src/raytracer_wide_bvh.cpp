@@ -0,0 +1,327 @@
+// Wide nodes collapsed from a binary SAH tree, with quantized child boxes as in Ylitie et al.,
+// "Efficient Incoherent Ray Traversal on GPUs Through Compressed Wide BVHs" (2017).
+
+#include "raytracer_wide_bvh.h"
+
+namespace Raytracer {
+
+// Slack on the float triangle test. Candidates it lets through are confirmed by the exact scalar test.
+#define WBVH_TRI_EPSILON 1e-4f
+
+void WideBVH::Build(const PrimitiveArrays& arrays) {
+    prims = &arrays;
+    nodes.clear();
+    leaves.clear();
+    triangles.clear();
+    others.clear();
+
+    BVH binary;
+    binary.Build(arrays);
+    root = binary.nodes.empty() ? WBVH_EMPTY : Collapse(binary, 0);
+}
+
+// Primitives under a binary node always form one contiguous range.
+static void SubtreeRange(const BVH& binary, int binary_i, int* first, int* count) {
+    const BVHNode& node = binary.nodes[binary_i];
+    if (node.count > 0) {
+        *first = node.offset;
+        *count = node.count;
+        return;
+    }
+    int right_first, right_count;
+    SubtreeRange(binary, node.offset, first, count);
+    SubtreeRange(binary, node.offset + 1, &right_first, &right_count);
+    *count += right_count;
+}
+
+int WideBVH::Collapse(const BVH& binary, int binary_i) {
+    const BVHNode& node = binary.nodes[binary_i];
+    // A leaf block tests WBVH_WIDTH triangles as cheaply as one, so small subtrees become a single leaf.
+    int first, count;
+    SubtreeRange(binary, binary_i, &first, &count);
+    if (node.count > 0 || count <= WBVH_WIDTH)
+        return MakeLeaf(binary, first, count);
+
+    // Keep opening the largest interior child until the node is full.
+    int children[WBVH_WIDTH] = {node.offset, node.offset + 1};
+    int child_count = 2;
+    while (child_count < WBVH_WIDTH) {
+        int best = -1;
+        float best_area = -1;
+        for (int i = 0; i < child_count; i++) {
+            const BVHNode& child = binary.nodes[children[i]];
+            if (child.count == 0 && child.bounds.SurfaceArea() > best_area) {
+                best = i;
+                best_area = child.bounds.SurfaceArea();
+            }
+        }
+        if (best == -1)
+            break;
+        int opened = binary.nodes[children[best]].offset;
+        children[best] = opened;
+        children[child_count++] = opened + 1;
+    }
+
+    WideBVHNode wide{};
+    const BVHPacketBounds& bounds = binary.packet_bounds[binary_i];
+    for (int axis = 0; axis < 3; axis++) {
+        wide.origin[axis] = bounds.min[axis];
+        wide.scale[axis] = (bounds.max[axis] - bounds.min[axis]) / 255.0f;
+        while (wide.origin[axis] + 255.0f * wide.scale[axis] < bounds.max[axis])
+            wide.scale[axis] = nextafterf(wide.scale[axis], INFINITY);
+    }
+
+    // Reserve the slot first, children are appended after it.
+    int wide_i = nodes.size();
+    nodes.push_back(wide);
+    for (int i = 0; i < WBVH_WIDTH; i++) {
+        if (i >= child_count) {
+            wide.child[i] = WBVH_EMPTY;
+            continue;
+        }
+        const BVHPacketBounds& child_bounds = binary.packet_bounds[children[i]];
+        for (int axis = 0; axis < 3; axis++) {
+            float origin = wide.origin[axis], scale = wide.scale[axis];
+            if (scale == 0)
+                continue;
+            // Round outward, then step until the decoded box really contains the child.
+            int lo = (int)fmax(0.0f, fmin(255.0f, floorf((child_bounds.min[axis] - origin) / scale)));
+            int hi = (int)fmax(0.0f, fmin(255.0f, ceilf((child_bounds.max[axis] - origin) / scale)));
+            while (lo > 0 && origin + lo * scale > child_bounds.min[axis]) lo--;
+            while (hi < 255 && origin + hi * scale < child_bounds.max[axis]) hi++;
+            wide.lo[axis][i] = lo;
+            wide.hi[axis][i] = hi;
+        }
+        wide.child[i] = Collapse(binary, children[i]);
+    }
+    nodes[wide_i] = wide;
+    return wide_i;
+}
+
+int WideBVH::MakeLeaf(const BVH& binary, int first, int count) {
+    WideBVHLeaf leaf{(int)triangles.size(), 0, (int)others.size(), 0};
+    for (int i = first; i < first + count; i++) {
+        uint32_t prim = binary.primitives[i];
+        const TriangleRecord* record = prims->Triangle(prim);
+        if (record == NULL) {
+            others.push_back(prim);
+            leaf.other_count++;
+            continue;
+        }
+
+        if (leaf.block_count == 0 || triangles.back().count == WBVH_WIDTH) {
+            triangles.push_back(WideBVHTriangles{});
+            leaf.block_count++;
+        }
+        WideBVHTriangles& block = triangles.back();
+        int lane = block.count++;
+        vec3 corners[3] = {record->v1, record->edge1, record->edge2};
+        float (*dest[3])[WBVH_WIDTH] = {block.v1, block.edge1, block.edge2};
+        for (int j = 0; j < 3; j++) {
+            dest[j][0][lane] = corners[j].x;
+            dest[j][1][lane] = corners[j].y;
+            dest[j][2][lane] = corners[j].z;
+        }
+        block.prims[lane] = prim;
+    }
+    leaves.push_back(leaf);
+    return -(int)(leaves.size() - 1) - 2;
+}
+
+// Slab test of one ray against every child box. Writes entry distances to t_near and returns the children hit.
+static int NodeIntersect(const WideBVHNode& node, const vfloat* pos, const vfloat* inv_dir, float t_max, float* t_near) {
+    int mask = 0;
+    for (int c = 0; c < WBVH_WIDTH; c += SIMD_WIDTH) {
+        vfloat t_enter, t_exit;
+        for (int axis = 0; axis < 3; axis++) {
+            vfloat origin(node.origin[axis]), scale(node.scale[axis]);
+            vfloat lo = origin + vfloat::FromBytes(&node.lo[axis][c]) * scale;
+            vfloat hi = origin + vfloat::FromBytes(&node.hi[axis][c]) * scale;
+            vfloat t1 = (lo - pos[axis]) * inv_dir[axis], t2 = (hi - pos[axis]) * inv_dir[axis];
+            if (axis == 0) {
+                t_enter = vmin(t1, t2);
+                t_exit = vmax(t1, t2);
+            } else {
+                t_enter = vmax(t_enter, vmin(t1, t2));
+                t_exit = vmin(t_exit, vmax(t1, t2));
+            }
+        }
+        t_enter.Store(t_near + c);
+        mask |= ((t_enter <= t_exit) & (t_exit >= vfloat(0.0f)) & (t_enter <= vfloat(t_max))).Bits() << c;
+    }
+    for (int i = 0; i < WBVH_WIDTH; i++) {
+        if (node.child[i] == WBVH_EMPTY) mask &= ~(1 << i);
+    }
+    return mask;
+}
+
+// Moller-Trumbore on a whole block in single precision, with some slack. Returns the lanes that may hit before t_max.
+static int TriangleCandidates(const WideBVHTriangles& block, const vfloat* pos, const vfloat* dir, float t_max) {
+    int mask = 0;
+    vfloat eps(WBVH_TRI_EPSILON);
+    vfloat t_limit(t_max * (1.0f + WBVH_TRI_EPSILON) + WBVH_TRI_EPSILON);
+    for (int c = 0; c < block.count; c += SIMD_WIDTH) {
+        vfloat e1[3], e2[3], to_origin[3];
+        for (int axis = 0; axis < 3; axis++) {
+            e1[axis] = vfloat::Load(&block.edge1[axis][c]);
+            e2[axis] = vfloat::Load(&block.edge2[axis][c]);
+            to_origin[axis] = pos[axis] - vfloat::Load(&block.v1[axis][c]);
+        }
+        vfloat px = dir[1] * e2[2] - dir[2] * e2[1];
+        vfloat py = dir[2] * e2[0] - dir[0] * e2[2];
+        vfloat pz = dir[0] * e2[1] - dir[1] * e2[0];
+        vfloat det = e1[0] * px + e1[1] * py + e1[2] * pz;
+        vfloat inv_det = vfloat(1.0f) / det;
+
+        vfloat u = (to_origin[0] * px + to_origin[1] * py + to_origin[2] * pz) * inv_det;
+        vfloat qx = to_origin[1] * e1[2] - to_origin[2] * e1[1];
+        vfloat qy = to_origin[2] * e1[0] - to_origin[0] * e1[2];
+        vfloat qz = to_origin[0] * e1[1] - to_origin[1] * e1[0];
+        vfloat v = (dir[0] * qx + dir[1] * qy + dir[2] * qz) * inv_det;
+        vfloat t = (e2[0] * qx + e2[1] * qy + e2[2] * qz) * inv_det;
+
+        vfloat zero(0.0f);
+        vfloat inside = (u >= zero - eps) & (v >= zero - eps) & (u + v <= vfloat(1.0f) + eps);
+        vfloat in_range = (t >= zero) & (t <= t_limit);
+        // A determinant that rounded to zero leaves u, v and t undefined, so let the exact test decide.
+        vfloat parallel = (det >= zero) & (det <= zero);
+        mask |= ((inside & in_range) | parallel).Bits() << c;
+    }
+    return mask & ((1 << block.count) - 1);
+}
+
+struct WideStackEntry {
+    int child;
+    float t_near;
+};
+
+bool WideBVH::FindIntersection(const Ray& ray, HitInformation* intersection) {
+    if (root == WBVH_EMPTY)
+        return false;
+
+    vfloat pos[3] = {(float)ray.pos.x, (float)ray.pos.y, (float)ray.pos.z};
+    vfloat dir[3] = {(float)ray.dir.x, (float)ray.dir.y, (float)ray.dir.z};
+    vfloat inv_dir[3] = {(float)(1.0 / ray.dir.x), (float)(1.0 / ray.dir.y), (float)(1.0 / ray.dir.z)};
+    float closest = INFINITY;
+
+    WideStackEntry stack[WBVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = WideStackEntry{root, 0};
+
+    PrimitiveHit current_hit, best_hit;
+    bool hit = false;
+    while (stack_size > 0) {
+        WideStackEntry entry = stack[--stack_size];
+        if (entry.t_near > closest)
+            continue;
+
+        if (entry.child >= 0) {
+            const WideBVHNode& node = nodes[entry.child];
+            SIMD_ALIGN float t_near[WBVH_WIDTH];
+            int mask = NodeIntersect(node, pos, inv_dir, closest, t_near);
+
+            // Push the hit children farthest first so the nearest is visited next.
+            WideStackEntry sorted[WBVH_WIDTH];
+            int sorted_count = 0;
+            for (int i = 0; i < WBVH_WIDTH; i++) {
+                if (!(mask & (1 << i)))
+                    continue;
+                int j = sorted_count++;
+                while (j > 0 && sorted[j - 1].t_near < t_near[i]) {
+                    sorted[j] = sorted[j - 1];
+                    j--;
+                }
+                sorted[j] = WideStackEntry{node.child[i], t_near[i]};
+            }
+            for (int i = 0; i < sorted_count; i++) {
+                stack[stack_size++] = sorted[i];
+            }
+            continue;
+        }
+
+        const WideBVHLeaf& leaf = leaves[-entry.child - 2];
+        for (int b = leaf.first_block; b < leaf.first_block + leaf.block_count; b++) {
+            const WideBVHTriangles& block = triangles[b];
+            int mask = TriangleCandidates(block, pos, dir, closest);
+            for (int i = 0; mask != 0; i++, mask >>= 1) {
+                if (!(mask & 1))
+                    continue;
+                if (prims->Intersect(block.prims[i], ray, &current_hit) && current_hit.t < closest) {
+                    best_hit = current_hit;
+                    closest = current_hit.t;
+                    hit = true;
+                }
+            }
+        }
+        for (int i = leaf.first_other; i < leaf.first_other + leaf.other_count; i++) {
+            if (prims->Intersect(others[i], ray, &current_hit) && current_hit.t < closest) {
+                best_hit = current_hit;
+                closest = current_hit.t;
+                hit = true;
+            }
+        }
+    }
+    if (hit)
+        prims->Resolve(ray, best_hit, intersection);
+    return hit;
+}
+
+bool WideBVH::Occluded(const Ray& ray, float t_max) {
+    if (root == WBVH_EMPTY)
+        return false;
+
+    vfloat pos[3] = {(float)ray.pos.x, (float)ray.pos.y, (float)ray.pos.z};
+    vfloat dir[3] = {(float)ray.dir.x, (float)ray.dir.y, (float)ray.dir.z};
+    vfloat inv_dir[3] = {(float)(1.0 / ray.dir.x), (float)(1.0 / ray.dir.y), (float)(1.0 / ray.dir.z)};
+
+    // Any blocker will do, so children are pushed in storage order.
+    int stack[WBVH_STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = root;
+
+    while (stack_size > 0) {
+        int child = stack[--stack_size];
+        if (child >= 0) {
+            const WideBVHNode& node = nodes[child];
+            SIMD_ALIGN float t_near[WBVH_WIDTH];
+            int mask = NodeIntersect(node, pos, inv_dir, t_max, t_near);
+            for (int i = 0; i < WBVH_WIDTH; i++) {
+                if (mask & (1 << i))
+                    stack[stack_size++] = node.child[i];
+            }
+            continue;
+        }
+
+        const WideBVHLeaf& leaf = leaves[-child - 2];
+        for (int b = leaf.first_block; b < leaf.first_block + leaf.block_count; b++) {
+            const WideBVHTriangles& block = triangles[b];
+            int mask = TriangleCandidates(block, pos, dir, t_max);
+            for (int i = 0; mask != 0; i++, mask >>= 1) {
+                if ((mask & 1) && prims->Occluded(block.prims[i], ray, t_max))
+                    return true;
+            }
+        }
+        for (int i = leaf.first_other; i < leaf.first_other + leaf.other_count; i++) {
+            if (prims->Occluded(others[i], ray, t_max))
+                return true;
+        }
+    }
+    return false;
+}
+
+string WideBVH::Stats() {
+    size_t prim_count = others.size();
+    for (const WideBVHTriangles& block : triangles) {
+        prim_count += block.count;
+    }
+    size_t per = prim_count ? prim_count : 1;
+    // Unlike BVH, the leaves carry their own copy of the triangles, so that share is listed separately.
+    size_t triangle_bytes = triangles.size() * sizeof(WideBVHTriangles);
+    size_t bytes = nodes.size() * sizeof(WideBVHNode) + leaves.size() * sizeof(WideBVHLeaf) + triangle_bytes +
+                   others.size() * sizeof(uint32_t);
+    return "Wide BVH" + to_string(WBVH_WIDTH) + ": " + to_string(nodes.size()) + " nodes, " + to_string(leaves.size()) +
+           " leaves over " + to_string(prim_count) + " primitives, " + to_string(bytes / per) +
+           " bytes per primitive (" + to_string(triangle_bytes / per) + " in triangle blocks)";
+}
+
+}  // namespace Raytracer
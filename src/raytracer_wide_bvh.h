@@ -0,0 +1,76 @@
+#ifndef _RAYTRACER_WIDE_BVH_H
+#define _RAYTRACER_WIDE_BVH_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "raytracer_bvh.h"
+#include "raytracer_simd.h"
+
+// Children per node. Boxes are tested SIMD_WIDTH at a time, so one node is one or two vector tests.
+#if SIMD_WIDTH == 8
+#define WBVH_WIDTH 8
+#else
+#define WBVH_WIDTH 4
+#endif
+// A node can push WBVH_WIDTH - 1 siblings, so this needs more room than the binary stack.
+#define WBVH_STACK_SIZE 256
+#define WBVH_EMPTY -1
+
+using namespace std;
+
+namespace Raytracer {
+
+// Child boxes are stored as bytes on a 255 step grid spanning the node's own box, rounded outward.
+struct WideBVHNode {
+    float origin[3];
+    // Size of one grid step per axis.
+    float scale[3];
+    uint8_t lo[3][WBVH_WIDTH];
+    uint8_t hi[3][WBVH_WIDTH];
+    // >= 0 for an interior node, WBVH_EMPTY for an unused slot, otherwise the leaf at -child - 2.
+    int child[WBVH_WIDTH];
+};
+
+// Up to WBVH_WIDTH triangles stored as structure of arrays so one ray is tested against all of them at once.
+struct SIMD_ALIGN WideBVHTriangles {
+    SIMD_ALIGN float v1[3][WBVH_WIDTH];
+    SIMD_ALIGN float edge1[3][WBVH_WIDTH];
+    SIMD_ALIGN float edge2[3][WBVH_WIDTH];
+    uint32_t prims[WBVH_WIDTH];
+    int count;
+};
+
+struct WideBVHLeaf {
+    // Range in WideBVH::triangles.
+    int first_block;
+    int block_count;
+    // Range in WideBVH::others, for primitives that are not triangles.
+    int first_other;
+    int other_count;
+};
+
+// BVH collapsed into WBVH_WIDTH-ary nodes. Uses less memory per primitive than the binary tree and
+// visits fewer nodes, which matters once a mesh no longer fits in cache.
+struct WideBVH : Accelerator {
+    vector<WideBVHNode> nodes;
+    vector<WideBVHLeaf> leaves;
+    vector<WideBVHTriangles> triangles;
+    vector<uint32_t> others;
+    // Encoded like WideBVHNode::child.
+    int root = WBVH_EMPTY;
+
+    void Build(const PrimitiveArrays& arrays);
+    bool FindIntersection(const Ray& ray, HitInformation* intersection);
+    bool Occluded(const Ray& ray, float t_max);
+    string Stats();
+
+  private:
+    // Turns the subtree under a binary node into wide nodes, returning its encoded child.
+    int Collapse(const BVH& binary, int binary_i);
+    int MakeLeaf(const BVH& binary, int first, int count);
+};
+
+}  // namespace Raytracer
+
+#endif